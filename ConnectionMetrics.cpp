@@ -0,0 +1,214 @@
+#include "ConnectionMetrics.hpp"
+
+/* ConnectionMetrics constructor - everything starts at zero. */
+ConnectionMetrics::ConnectionMetrics()
+        : attempts(0)
+        , successes(0)
+        , connected_total(0)
+        , connected_since(0)
+        , connected(false)
+{
+        memset(failures, 0, sizeof(failures));
+        memset(&handshake, 0, sizeof(handshake));
+        memset(&publish, 0, sizeof(publish));
+        memset(topics, 0, sizeof(topics));
+}
+
+
+void ConnectionMetrics::record_attempt()
+{
+        attempts++;
+}
+
+
+/* Connected - count it, bucket the handshake and start the clock */
+void ConnectionMetrics::record_connected(const uint32_t& handshake_ms)
+{
+        successes++;
+        _histogram_add(handshake, METRICS_HANDSHAKE_BASE, handshake_ms);
+        connected_since = millis();
+        connected = true;
+}
+
+
+void ConnectionMetrics::record_failure(const ConnectFailure& cause)
+{
+        failures[cause]++;
+}
+
+
+/* Stop the clock on a dropped connection */
+void ConnectionMetrics::record_disconnected()
+{
+        if (connected) {
+                connected_total += millis() - connected_since;
+                connected = false;
+        }
+}
+
+
+/* An incoming message - the topic isn't NUL terminated, so pass its length */
+void ConnectionMetrics::record_in(
+        const char* topic,
+        const size_t& len,
+        const size_t& bytes
+)
+{
+        TopicTraffic& traffic = _traffic(topic, len);
+        traffic.messages_in++;
+        traffic.bytes_in += bytes;
+}
+
+
+/* An outgoing message and how long the publish took */
+void ConnectionMetrics::record_out(
+        const char* topic,
+        const size_t& bytes,
+        const uint32_t& latency_ms
+)
+{
+        TopicTraffic& traffic = _traffic(topic, strlen(topic));
+        traffic.messages_out++;
+        traffic.bytes_out += bytes;
+        _histogram_add(publish, METRICS_PUBLISH_BASE, latency_ms);
+}
+
+
+uint32_t ConnectionMetrics::time_connected() const
+{
+        if (connected) {
+                return connected_total + (millis() - connected_since);
+        }
+        return connected_total;
+}
+
+
+/* Serialize the block - see the header for the format */
+size_t ConnectionMetrics::to_json(char* buffer, const size_t& buffer_len) const
+{
+        size_t used = snprintf_P(
+                buffer,
+                buffer_len,
+                PSTR("{\"att\":%u,\"ok\":%u,\"fail\":[%u,%u,%u],"
+                     "\"up\":%u,\"hs\":"),
+                attempts,
+                successes,
+                failures[CONNECT_FAILED_WIFI],
+                failures[CONNECT_FAILED_TRANSPORT],
+                failures[CONNECT_FAILED_MQTT],
+                time_connected()
+        );
+        if (used >= buffer_len) {
+                return buffer_len;
+        }
+        used += _histogram_json(handshake, buffer + used, buffer_len - used);
+        used += snprintf_P(buffer + used, buffer_len - used, PSTR(",\"pub\":"));
+        if (used >= buffer_len) {
+                return buffer_len;
+        }
+        used += _histogram_json(publish, buffer + used, buffer_len - used);
+        used += snprintf_P(buffer + used, buffer_len - used, PSTR(",\"t\":["));
+        if (used >= buffer_len) {
+                return buffer_len;
+        }
+
+        // Each topic has to leave room for the closing ']}'.
+        bool first = true;
+        for (uint8_t i = 0; i <= METRICS_MAX_TOPICS; ++i) {
+                const TopicTraffic& traffic = topics[i];
+                if (traffic.messages_in == 0 and traffic.messages_out == 0) {
+                        continue;
+                }
+                int len = snprintf_P(
+                        buffer + used,
+                        buffer_len - used,
+                        PSTR("%s[\"%s\",%u,%u,%u,%u]"),
+                        first ? "" : ",",
+                        i < METRICS_MAX_TOPICS ? traffic.topic : "*",
+                        traffic.messages_in,
+                        traffic.bytes_in,
+                        traffic.messages_out,
+                        traffic.bytes_out
+                );
+                if (len < 0 or used + len + 3 > buffer_len) {
+                        buffer[used] = '\0';
+                        break;
+                }
+                used += len;
+                first = false;
+        }
+
+        if (used + 3 > buffer_len) {
+                return buffer_len;
+        }
+        used += snprintf_P(buffer + used, buffer_len - used, PSTR("]}"));
+        return used;
+}
+
+
+/*
+ * Find a topic's counters, claiming a free slot for a new topic.  Topics
+ * are compared on their first METRICS_TOPIC_LEN - 1 characters; once the
+ * named slots are gone, new topics share the last, catch-all, slot.
+ */
+TopicTraffic& ConnectionMetrics::_traffic(const char* topic, const size_t& len)
+{
+        size_t n = len < METRICS_TOPIC_LEN - 1 ? len : METRICS_TOPIC_LEN - 1;
+        for (uint8_t i = 0; i < METRICS_MAX_TOPICS; ++i) {
+                if (topics[i].topic[0] == '\0') {
+                        memcpy(topics[i].topic, topic, n);
+                        topics[i].topic[n] = '\0';
+                        return topics[i];
+                }
+                if (strlen(topics[i].topic) == n and
+                    strncmp(topics[i].topic, topic, n) == 0
+                ) {
+                        return topics[i];
+                }
+        }
+        return topics[METRICS_MAX_TOPICS];
+}
+
+
+/* Bucket a value - counters stick at their maximum rather than wrap */
+void ConnectionMetrics::_histogram_add(
+        MetricsHistogram& histogram,
+        const uint32_t& base,
+        const uint32_t& value
+)
+{
+        uint8_t i = 0;
+        while (i < METRICS_HISTOGRAM_BUCKETS - 1 and value >= (base << i)) {
+                ++i;
+        }
+        if (histogram.buckets[i] < 0xffff) {
+                histogram.buckets[i]++;
+        }
+}
+
+
+/* '[n,n,...]' */
+size_t ConnectionMetrics::_histogram_json(
+        const MetricsHistogram& histogram,
+        char* buffer,
+        const size_t& buffer_len
+)
+{
+        size_t used = 0;
+        for (uint8_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; ++i) {
+                if (used >= buffer_len) {
+                        return buffer_len;
+                }
+                used += snprintf_P(
+                        buffer + used,
+                        buffer_len - used,
+                        PSTR("%c%u"),
+                        i == 0 ? '[' : ',',
+                        histogram.buckets[i]
+                );
+        }
+        if (used < buffer_len) {
+                used += snprintf_P(buffer + used, buffer_len - used, PSTR("]"));
+        }
+        return used < buffer_len ? used : buffer_len;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <Arduino.h>
+
+/* Connection Metrics Definitions */
+// Histogram buckets - each twice as wide as the one before, the last open
+#define METRICS_HISTOGRAM_BUCKETS       8
+// Handshakes: <250 ms, <500 ms ... <16 s, 16 s and up
+#define METRICS_HANDSHAKE_BASE          250
+// Publishes: <2 ms, <4 ms ... <128 ms, 128 ms and up
+#define METRICS_PUBLISH_BASE            2
+// Topics we keep traffic counters for - the rest are lumped together
+#define METRICS_MAX_TOPICS              4
+#define METRICS_TOPIC_LEN               32
+
+
+/* Why a connect attempt failed */
+enum ConnectFailure {
+        CONNECT_FAILED_WIFI = 0,
+        CONNECT_FAILED_TRANSPORT,
+        CONNECT_FAILED_MQTT,
+        CONNECT_FAILURE_CAUSES
+};
+
+
+/* Log2 histogram - buckets[i] counts values below base << i */
+struct MetricsHistogram {
+        uint16_t        buckets[METRICS_HISTOGRAM_BUCKETS];
+};
+
+
+/* Traffic on one topic (or, with an empty name, every other topic) */
+struct TopicTraffic {
+        char            topic[METRICS_TOPIC_LEN];
+        uint32_t        messages_in;
+        uint32_t        bytes_in;
+        uint32_t        messages_out;
+        uint32_t        bytes_out;
+};
+
+
+/*
+ * ConnectionMetrics is a fixed size block of connection health counters:
+ * connect attempts and failures by cause, handshake and publish latency
+ * histograms, time connected and traffic by topic.  Nothing allocates and
+ * nothing is reset, so the block can be published as is.
+ *
+ * Publishes are QoS 0 - there is no PUBACK to wait for - so the publish
+ * latency is the time to hand the packet to the transport.
+ */
+class ConnectionMetrics {
+public:
+        ConnectionMetrics();
+
+        /* Connect lifecycle */
+        void record_attempt();
+        void record_connected(const uint32_t& handshake_ms);
+        void record_failure(const ConnectFailure& cause);
+        void record_disconnected();
+
+        /* Traffic */
+        void record_in(
+                const char* topic,
+                const size_t& len,
+                const size_t& bytes
+        );
+        void record_out(
+                const char* topic,
+                const size_t& bytes,
+                const uint32_t& latency_ms
+        );
+
+        /* Milliseconds connected since boot, including right now */
+        uint32_t time_connected() const;
+
+        /*
+         * Serialize for the metrics topic:
+         *   {"att":..,"ok":..,"fail":[wifi,transport,mqtt],"up":<ms>,
+         *    "hs":[..],"pub":[..],"t":[[<topic>,in,in_B,out,out_B],..]}
+         * Topics that don't fit in buffer_len are left off.
+         */
+        size_t to_json(char* buffer, const size_t& buffer_len) const;
+
+private:
+        TopicTraffic& _traffic(const char* topic, const size_t& len);
+        static void _histogram_add(
+                MetricsHistogram& histogram,
+                const uint32_t& base,
+                const uint32_t& value
+        );
+        static size_t _histogram_json(
+                const MetricsHistogram& histogram,
+                char* buffer,
+                const size_t& buffer_len
+        );
+
+        uint32_t                        attempts;
+        uint32_t                        successes;
+        uint32_t                        failures[CONNECT_FAILURE_CAUSES];
+
+        MetricsHistogram                handshake;
+        MetricsHistogram                publish;
+
+        /* Time connected, not counting the current connection */
+        uint32_t                        connected_total;
+        uint32_t                        connected_since;
+        bool                            connected;
+
+        /* Named topics, then the catch-all */
+        TopicTraffic                    topics[METRICS_MAX_TOPICS + 1];
+};
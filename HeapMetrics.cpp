@@ -0,0 +1,283 @@
+#include "HeapMetrics.hpp"
+#include "Log.hpp"
+
+#ifdef ARDUINO
+#include <cont.h>
+// The continuation loop() runs on - see cont.h
+extern "C" cont_t* g_pcont;
+#else
+#include <assert.h>
+#endif
+
+/*
+ * Allocation counters live outside the class - operator new runs during
+ * static initialization, before any HeapMetrics is constructed, and these
+ * start at zero without a constructor.
+ */
+static AllocationStats allocation_counters;
+
+/* Set by seal(), and how many HeapSealExemptions are alive */
+static bool heap_sealed = false;
+static uint8_t seal_exemptions = 0;
+
+/* after_seal when sample() last looked, so each new violation is logged */
+static uint32_t reported_after_seal = 0;
+
+
+/* HeapMetrics constructor - the first sample sets the marks. */
+HeapMetrics::HeapMetrics()
+        : last_sample(0)
+{
+        memset(&heap, 0, sizeof(heap));
+}
+
+
+void HeapMetrics::yield()
+{
+        if (heap.samples == 0 or
+            millis() - last_sample >= HEAP_SAMPLE_INTERVAL
+        ) {
+                sample();
+        }
+}
+
+
+/* Read the heap and move the marks - a new low for free heap is logged */
+void HeapMetrics::sample()
+{
+        last_sample = millis();
+
+        heap.free_now = ESP.getFreeHeap();
+        heap.max_block_now = ESP.getMaxFreeBlockSize();
+        heap.fragmentation_now = ESP.getHeapFragmentation();
+
+        if (heap.samples == 0) {
+                heap.free_min = heap.free_now;
+                heap.max_block_min = heap.max_block_now;
+                heap.fragmentation_max = heap.fragmentation_now;
+        }
+        heap.samples++;
+
+        if (heap.free_now < heap.free_min) {
+                heap.free_min = heap.free_now;
+                LOG_DEBUG(
+                        LOG_SYSTEM,
+                        "Heap low-water: %u free, %u largest block, %u%% "
+                        "fragmented",
+                        heap.free_now,
+                        heap.max_block_now,
+                        heap.fragmentation_now
+                );
+        }
+        if (heap.max_block_now < heap.max_block_min) {
+                heap.max_block_min = heap.max_block_now;
+        }
+        if (heap.fragmentation_now > heap.fragmentation_max) {
+                heap.fragmentation_max = heap.fragmentation_now;
+        }
+
+        // Logging from inside operator new isn't safe, so report here.
+        if (allocation_counters.after_seal != reported_after_seal) {
+                LOG_ERROR(
+                        LOG_SYSTEM,
+                        "%u allocations after the heap was sealed",
+                        allocation_counters.after_seal - reported_after_seal
+                );
+                reported_after_seal = allocation_counters.after_seal;
+        }
+}
+
+
+const AllocationStats& HeapMetrics::allocation_stats()
+{
+        return allocation_counters;
+}
+
+
+/* Serialize the block - see the header for the format */
+size_t HeapMetrics::to_json(char* buffer, const size_t& buffer_len) const
+{
+        int used = snprintf_P(
+                buffer,
+                buffer_len,
+                PSTR("{\"up\":%u,\"rst\":%u,\"free\":[%u,%u],\"blk\":[%u,%u],"
+                     "\"frag\":[%u,%u],\"new\":%u,\"del\":%u,\"oom\":%u,"
+                     "\"seal\":%u}"),
+                millis() / 1000,
+                ESP.getResetInfoPtr()->reason,
+                heap.free_now,
+                heap.free_min,
+                heap.max_block_now,
+                heap.max_block_min,
+                heap.fragmentation_now,
+                heap.fragmentation_max,
+                allocation_counters.allocations,
+                allocation_counters.frees,
+                allocation_counters.failures,
+                allocation_counters.after_seal
+        );
+        if (used < 0) {
+                return 0;
+        }
+        return (size_t)used < buffer_len ? used : buffer_len;
+}
+
+
+/*
+ * Is this the sketch allocating?  Not if we're in an interrupt, or in the
+ * system context where lwIP and the WiFi stack run.
+ */
+static bool sketch_context()
+{
+#ifdef ARDUINO
+        return cont_can_yield(g_pcont);
+#else
+        return true;
+#endif
+}
+
+
+/* Count an allocation - and catch it if the heap is sealed */
+void HeapMetrics::record_alloc(const bool& succeeded)
+{
+#if HEAP_SEAL_AFTER_SETUP == 1
+        if (heap_sealed and seal_exemptions == 0 and sketch_context()) {
+                allocation_counters.after_seal++;
+#ifndef ARDUINO
+                // assert() allocates its message - don't catch that too.
+                heap_sealed = false;
+                assert(!"heap allocation after setup()");
+#endif
+        }
+#endif
+        if (succeeded) {
+                allocation_counters.allocations++;
+        } else {
+                allocation_counters.failures++;
+        }
+}
+
+
+void HeapMetrics::record_free()
+{
+        allocation_counters.frees++;
+}
+
+
+void HeapMetrics::seal()
+{
+        heap_sealed = true;
+}
+
+
+bool HeapMetrics::sealed()
+{
+        return heap_sealed;
+}
+
+
+HeapSealExemption::HeapSealExemption()
+{
+        seal_exemptions++;
+}
+
+
+HeapSealExemption::~HeapSealExemption()
+{
+        seal_exemptions--;
+}
+
+
+#if HEAP_TRACK_ALLOCATIONS == 1 and HEAP_TRACK_MALLOC == 1
+/*
+ * Linked with -Wl,--wrap=malloc (and calloc, realloc and free), every call
+ * to them lands here first and __real_malloc is the core's own.  new and
+ * delete come through here too.  The host stubs wrap them the same way.
+ */
+extern "C" {
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size)
+{
+        void* ptr = __real_malloc(size);
+        HeapMetrics::record_alloc(ptr != NULL);
+        return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+        void* ptr = __real_calloc(count, size);
+        HeapMetrics::record_alloc(ptr != NULL);
+        return ptr;
+}
+
+/* Resizing is an allocation, moved or not - a String growing is caught */
+void* __wrap_realloc(void* ptr, size_t size)
+{
+        void* moved = __real_realloc(ptr, size);
+        if (size > 0) {
+                HeapMetrics::record_alloc(moved != NULL);
+        }
+        if (ptr != NULL and (moved != NULL or size == 0)) {
+                HeapMetrics::record_free();
+        }
+        return moved;
+}
+
+void __wrap_free(void* ptr)
+{
+        if (ptr != NULL) {
+                HeapMetrics::record_free();
+        }
+        __real_free(ptr);
+}
+
+}
+#elif HEAP_TRACK_ALLOCATIONS == 1
+/* Counting replacements for the core's operator new and delete */
+void* operator new(size_t size)
+{
+        void* ptr = malloc(size);
+        HeapMetrics::record_alloc(ptr != NULL);
+        return ptr;
+}
+
+void* operator new[](size_t size)
+{
+        void* ptr = malloc(size);
+        HeapMetrics::record_alloc(ptr != NULL);
+        return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+        if (ptr != NULL) {
+                HeapMetrics::record_free();
+                free(ptr);
+        }
+}
+
+void operator delete[](void* ptr) noexcept
+{
+        if (ptr != NULL) {
+                HeapMetrics::record_free();
+                free(ptr);
+        }
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* ptr, size_t) noexcept
+{
+        operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+        operator delete[](ptr);
+}
+#endif
+#endif
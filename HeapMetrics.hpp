@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+
+/* Heap Metrics Definitions */
+// How often yield() samples the heap - each sample walks the free list
+#define HEAP_SAMPLE_INTERVAL            1000
+// Count every allocation and free - set to 0 to leave the heap alone
+#ifndef HEAP_TRACK_ALLOCATIONS
+#define HEAP_TRACK_ALLOCATIONS          1
+#endif
+// Count them in malloc(), calloc(), realloc() and free(), so Strings and
+// libraries are seen too, not just new.  The linker has to wrap those four
+// (see the README) - without that the link fails on __real_malloc.  Set to
+// 0 to count only new and delete, by replacing them.
+#ifndef HEAP_TRACK_MALLOC
+#define HEAP_TRACK_MALLOC               1
+#endif
+// Once setup() seals the heap, every allocation from the sketch is a bug -
+// counted on the board, an assert on the host.  Needs
+// HEAP_TRACK_ALLOCATIONS.
+#ifndef HEAP_SEAL_AFTER_SETUP
+#define HEAP_SEAL_AFTER_SETUP           1
+#endif
+
+
+/* The heap right now, and the worst we've seen since boot */
+struct HeapStats {
+        uint32_t        samples;
+
+        /* Bytes free */
+        uint32_t        free_now;
+        uint32_t        free_min;
+
+        /* Largest block we could allocate */
+        uint32_t        max_block_now;
+        uint32_t        max_block_min;
+
+        /* 0 - 100, how badly the free space is split up */
+        uint8_t         fragmentation_now;
+        uint8_t         fragmentation_max;
+};
+
+
+/* Allocations and frees since boot - see HEAP_TRACK_MALLOC */
+struct AllocationStats {
+        uint32_t        allocations;
+        uint32_t        frees;
+        uint32_t        failures;
+
+        /* Allocations after seal() outside a HeapSealExemption */
+        uint32_t        after_seal;
+};
+
+
+/*
+ * HeapMetrics samples free heap, the largest free block and fragmentation
+ * every HEAP_SAMPLE_INTERVAL and keeps low-water marks, so a station that
+ * resets after a few days can tell us whether the heap was worn down or
+ * chopped up first.  Free heap alone hides the second case - 10 KiB free in
+ * 200 byte pieces can't hold a TLS record.
+ *
+ * Low-water marks are sampled, so a dip that comes and goes between two
+ * samples is missed; sample() right after something heavy to catch it.
+ *
+ * With HEAP_TRACK_ALLOCATIONS we also count allocations and frees, which
+ * shows when some code path starts allocating more.  HEAP_TRACK_MALLOC
+ * counts them in malloc() itself, so a String growing or a library's
+ * buffer is seen as well as new.
+ *
+ * Everything the station needs is reserved by the end of setup(), so with
+ * HEAP_SEAL_AFTER_SETUP any later allocation is counted as a violation -
+ * fragmentation can't build up over weeks of uptime if nothing is
+ * allocated.  The network code gets a pass, through HeapSealExemption,
+ * while it connects and writes.  Only the sketch's own context is held to
+ * the seal - lwIP and the WiFi stack allocate from the system context as
+ * packets come and go.
+ */
+class HeapMetrics {
+public:
+        HeapMetrics();
+
+        /* Call every loop() - samples if HEAP_SAMPLE_INTERVAL has passed */
+        void yield();
+
+        /* Sample right now */
+        void sample();
+
+        const HeapStats& stats() const { return heap; }
+        static const AllocationStats& allocation_stats();
+
+        /*
+         * Serialize for the metrics topic:
+         *   {"up":<s>,"rst":<reason>,"free":[now,min],"blk":[now,min],
+         *    "frag":[now,max],"new":..,"del":..,"oom":..,"seal":..}
+         */
+        size_t to_json(char* buffer, const size_t& buffer_len) const;
+
+        /* Called by our malloc() wrappers, or operator new and delete */
+        static void record_alloc(const bool& succeeded);
+        static void record_free();
+
+        /* Allocating is a violation from here on - end of setup() */
+        static void seal();
+        static bool sealed();
+
+private:
+        HeapStats                       heap;
+
+        /* millis() of the last sample */
+        uint32_t                        last_sample;
+};
+
+
+/*
+ * Allocations are allowed again while one of these is alive - for library
+ * code that has to allocate, like a TLS handshake.  Exemptions nest.
+ */
+class HeapSealExemption {
+public:
+        HeapSealExemption();
+        ~HeapSealExemption();
+};
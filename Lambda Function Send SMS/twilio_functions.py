@@ -3,6 +3,9 @@
 When rules with type 'Outgoing' are posted in the 'twilio' topic, IoT will
 forward them to the iot_handler() function.  Here we demonstrate very basic
 sanity checks and (if valid) send an MMS or SMS for our IoT Device.
+
+'To' may also be a list of numbers when the device coalesces replies to
+several people; each of them gets their own copy of the message.
 """
 from __future__ import print_function
 
@@ -39,6 +42,11 @@ def iot_handler(event, context):
     if 'Image' in event:
         picture_url = event['Image']
 
-    send_message(event['To'], event['From'], event['Body'], picture_url)
+    to_numbers = event['To']
+    if not isinstance(to_numbers, list):
+        to_numbers = [to_numbers]
+
+    for to_number in to_numbers:
+        send_message(to_number, event['From'], event['Body'], picture_url)
 
     return
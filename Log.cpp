@@ -0,0 +1,44 @@
+#include "Log.hpp"
+
+#include <stdarg.h>
+
+/* Nowhere, until setup() says otherwise */
+static Print* log_output = NULL;
+
+
+void log_set_output(Print* output)
+{
+        log_output = output;
+}
+
+
+void log_write(const uint8_t* data, const size_t& len)
+{
+        if (log_output != NULL) {
+                log_output->write(data, len);
+        }
+}
+
+
+/* Format into a stack buffer and write the line in one go */
+void log_printf_P(PGM_P format, ...)
+{
+        if (log_output == NULL) {
+                return;
+        }
+
+        char line[LOG_LINE_LEN];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf_P(line, sizeof(line) - 2, format, args);
+        va_end(args);
+        if (len < 0) {
+                return;
+        }
+        if (len > (int)sizeof(line) - 3) {
+                len = sizeof(line) - 3;
+        }
+        line[len++] = '\r';
+        line[len++] = '\n';
+        log_output->write((const uint8_t*)line, len);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Log levels.  Anything above LOG_LEVEL compiles to nothing - no call, no
+ * argument evaluation and no format string in flash.
+ */
+#define LOG_LEVEL_NONE                  0
+#define LOG_LEVEL_ERROR                 1
+#define LOG_LEVEL_WARN                  2
+#define LOG_LEVEL_INFO                  3
+#define LOG_LEVEL_DEBUG                 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL                       LOG_LEVEL_INFO
+#endif
+
+/*
+ * Log categories.  Clear a bit in LOG_CATEGORIES to drop a whole area; the
+ * test is on constants, so the optimizer removes those calls too.
+ */
+#define LOG_NET                         0x01    // WiFi, TLS, reconnects
+#define LOG_MQTT                        0x02    // publish, subscribe, receive
+#define LOG_WEATHER                     0x04    // sensors and observations
+#define LOG_SMS                         0x08    // Twilio messages
+#define LOG_SHADOW                      0x10    // device shadow, preferences
+#define LOG_SYSTEM                      0x20    // heap, boot
+
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES                  0xff
+#endif
+
+// Longest line we format - longer lines are cut short
+#define LOG_LINE_LEN                    160
+
+/*
+ * Set to 1 to send compact binary records instead of text: a token for
+ * the format string plus the raw arguments.  The format strings stay on
+ * the host - decode with log_decode.py.
+ */
+#ifndef LOG_TOKENIZED
+#define LOG_TOKENIZED                   0
+#endif
+
+// First byte of every binary record
+#define LOG_TOKEN_SYNC                  0xa5
+
+
+/* Where log lines go - NULL (the default) throws them away */
+void log_set_output(Print* output);
+
+/* Write raw bytes straight to the output */
+void log_write(const uint8_t* data, const size_t& len);
+
+/*
+ * printf style, one line per call - the line ending is added for us.  The
+ * format lives in flash (PSTR); arguments are read from RAM as usual.
+ * Floats (%f) need the printf float support in core 2.4 and later.
+ */
+void log_printf_P(PGM_P format, ...)
+        __attribute__((format(printf, 1, 2)));
+
+
+#if LOG_TOKENIZED == 1
+#include "LogTokens.hpp"
+
+#define LOG_WRITE(category, format, ...)                                \
+        do {                                                            \
+                if ((category) & LOG_CATEGORIES) {                      \
+                        constexpr uint32_t log_id = log_token(format);  \
+                        log_tokens(log_id, ##__VA_ARGS__);              \
+                }                                                       \
+        } while (0)
+#else
+#define LOG_WRITE(category, format, ...)                                \
+        do {                                                            \
+                if ((category) & LOG_CATEGORIES) {                      \
+                        log_printf_P(PSTR(format), ##__VA_ARGS__);      \
+                }                                                       \
+        } while (0)
+#endif
+
+#define LOG_NOTHING()                   do {} while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(category, ...)        LOG_WRITE(category, __VA_ARGS__)
+#else
+#define LOG_ERROR(category, ...)        LOG_NOTHING()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(category, ...)         LOG_WRITE(category, __VA_ARGS__)
+#else
+#define LOG_WARN(category, ...)         LOG_NOTHING()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(category, ...)         LOG_WRITE(category, __VA_ARGS__)
+#else
+#define LOG_INFO(category, ...)         LOG_NOTHING()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, ...)        LOG_WRITE(category, __VA_ARGS__)
+#else
+#define LOG_DEBUG(category, ...)        LOG_NOTHING()
+#endif
@@ -0,0 +1,106 @@
+#include "LogBuffer.hpp"
+
+/* LogBuffer constructor - empty ring. */
+LogBuffer::LogBuffer(Print* output_in, const bool& reports_room_in)
+        : output(output_in)
+        , reports_room(reports_room_in)
+        , head(0)
+        , tail(0)
+        , dropped_pending(0)
+        , dropped_total(0)
+{
+}
+
+
+size_t LogBuffer::write(uint8_t c)
+{
+        return write(&c, 1);
+}
+
+
+/*
+ * Queue a line.  If lines were dropped before it, try to get the note in
+ * first - if even that doesn't fit, this line is dropped too.
+ */
+size_t LogBuffer::write(const uint8_t* buffer, size_t size)
+{
+        if (dropped_pending > 0) {
+                char note[40];
+                int len = snprintf_P(
+                        note,
+                        sizeof(note),
+                        PSTR("[%u log lines dropped]\r\n"),
+                        dropped_pending
+                );
+                size_t room = LOG_BUFFER_SIZE - pending();
+                if (len < 0 or room < (size_t)len + size or
+                    !_push((const uint8_t*)note, len)
+                ) {
+                        dropped_pending++;
+                        dropped_total++;
+                        return size;
+                }
+                dropped_pending = 0;
+        }
+
+        if (!_push(buffer, size)) {
+                dropped_pending++;
+                dropped_total++;
+        }
+
+        // Dropped or not, tell the caller it's handled so it moves on.
+        return size;
+}
+
+
+/* Hand the output what it can take without blocking */
+void LogBuffer::drain()
+{
+        if (output == NULL) {
+                tail = head;
+                return;
+        }
+
+        uint16_t budget = LOG_DRAIN_BUDGET;
+        if (reports_room) {
+                int room = output->availableForWrite();
+                if (room <= 0) {
+                        return;
+                }
+                budget = room;
+        }
+
+        while (budget > 0 and pending() > 0) {
+                // Up to the end of the ring, then wrap on the next pass
+                uint16_t start = tail & (LOG_BUFFER_SIZE - 1);
+                uint16_t chunk = pending();
+                if (chunk > LOG_BUFFER_SIZE - start) {
+                        chunk = LOG_BUFFER_SIZE - start;
+                }
+                if (chunk > budget) {
+                        chunk = budget;
+                }
+
+                size_t written = output->write(ring + start, chunk);
+                tail += written;
+                budget -= written;
+                if (written < chunk) {
+                        break;
+                }
+        }
+}
+
+
+/* All or nothing - partial lines would only confuse the reader */
+bool LogBuffer::_push(const uint8_t* data, const size_t& len)
+{
+        if (len > (size_t)(LOG_BUFFER_SIZE - pending())) {
+                return false;
+        }
+
+        for (size_t i = 0; i < len; ++i) {
+                ring[(head + i) & (LOG_BUFFER_SIZE - 1)] = data[i];
+        }
+        head += len;
+        return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Arduino.h>
+
+/* Log Buffer Definitions */
+// Ring size in bytes - must be a power of two
+#define LOG_BUFFER_SIZE                 1024
+// Bytes per drain() when the port can't say how much it takes without
+// blocking (SoftwareSerial at 115200 is ~87 us a byte, so ~3 ms)
+#define LOG_DRAIN_BUDGET                32
+
+
+/*
+ * LogBuffer is a Print that queues log lines in a ring buffer instead of
+ * writing them out, so logging never waits on the serial port.  Call
+ * drain() from loop() to move what the port can take right now.
+ *
+ * Hardware serial tells us how much room its FIFO has, and we never write
+ * more than that - when it says 0 the FIFO is full and we wait.  Ports
+ * that can't tell (SoftwareSerial, which bit-bangs with interrupts off)
+ * get LOG_DRAIN_BUDGET bytes per call.  Which kind of port it is comes in
+ * with the constructor; availableForWrite() alone can't say.
+ *
+ * When a line doesn't fit it is dropped whole and counted, and the next
+ * line that fits is preceded by a note of how many went missing.
+ *
+ * One writer (the main loop) and one reader (drain(), also the main loop
+ * or a timer) - the indices are free running, so no locking is needed.
+ */
+class LogBuffer : public Print {
+public:
+        /*
+         * reports_room_in is true if output_in's availableForWrite() is
+         * the room it really has (HardwareSerial), false if not.
+         */
+        LogBuffer(Print* output_in, const bool& reports_room_in);
+
+        /* Print interface - queue, never block */
+        virtual size_t write(uint8_t c);
+        virtual size_t write(const uint8_t* buffer, size_t size);
+
+        /* Move queued bytes to the output, as many as it takes now */
+        void drain();
+
+        /* Lines dropped because the ring was full */
+        uint32_t overflows() const { return dropped_total; }
+
+        /* Bytes waiting */
+        uint16_t pending() const { return head - tail; }
+
+private:
+        bool _push(const uint8_t* data, const size_t& len);
+
+        Print*                          output;
+        bool                            reports_room;
+
+        uint8_t                         ring[LOG_BUFFER_SIZE];
+        volatile uint16_t               head;
+        volatile uint16_t               tail;
+
+        /* Dropped since the last note, and ever */
+        uint16_t                        dropped_pending;
+        uint32_t                        dropped_total;
+};
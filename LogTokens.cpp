@@ -0,0 +1,65 @@
+#include "Log.hpp"
+
+#if LOG_TOKENIZED == 1
+
+/* Start a record - sync byte, token and argument count */
+LogRecord::LogRecord(const uint32_t& token, const uint8_t& argc)
+        : len(0)
+{
+        data[len++] = LOG_TOKEN_SYNC;
+        memcpy(data + len, &token, sizeof(token));
+        len += sizeof(token);
+        data[len++] = argc;
+}
+
+
+/* Append one argument, if there's room - the decoder notices a short one */
+void LogRecord::put(const uint8_t& type, const void* value, const size_t& size)
+{
+        if (len + 1 + size > sizeof(data)) {
+                return;
+        }
+        data[len++] = type;
+        memcpy(data + len, value, size);
+        len += size;
+}
+
+
+void log_arg(LogRecord& record, const int32_t& value)
+{
+        record.put('i', &value, sizeof(value));
+}
+
+
+void log_arg(LogRecord& record, const uint32_t& value)
+{
+        record.put('u', &value, sizeof(value));
+}
+
+
+void log_arg(LogRecord& record, const float& value)
+{
+        record.put('f', &value, sizeof(value));
+}
+
+
+/* Strings go as [len:1][bytes] */
+void log_arg(LogRecord& record, const char* value)
+{
+        if (value == NULL) {
+                value = "(null)";
+        }
+        size_t n = strlen(value);
+        if (n > 255) {
+                n = 255;
+        }
+        if (record.len + 2 + n > sizeof(record.data)) {
+                return;
+        }
+        record.data[record.len++] = 's';
+        record.data[record.len++] = n;
+        memcpy(record.data + record.len, value, n);
+        record.len += n;
+}
+
+#endif
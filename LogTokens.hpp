@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+#include <type_traits>
+
+/*
+ * Tokenized log records - see LOG_TOKENIZED in Log.hpp.
+ *
+ * A record is:
+ *      [0xa5][token:4][argc:1] then per argument [type:1][value]
+ * with the token the 32 bit FNV-1a hash of the format string, and values
+ *      'i' int32, 'u' uint32, 'f' float - 4 bytes, little endian
+ *      's' string - [len:1][bytes], cut at 255
+ * The hash is worked out by the compiler, so the format string itself
+ * never reaches the device.
+ */
+
+/* FNV-1a, one character per step so it stays a C++11 constexpr */
+constexpr uint32_t log_token(const char* s, uint32_t hash = 2166136261u)
+{
+        return *s ? log_token(s + 1, (hash ^ (uint8_t)*s) * 16777619u)
+                  : hash;
+}
+
+
+/* A record being built on the stack */
+struct LogRecord {
+        uint8_t         data[LOG_LINE_LEN];
+        size_t          len;
+
+        LogRecord(const uint32_t& token, const uint8_t& argc);
+
+        void put(const uint8_t& type, const void* value, const size_t& size);
+};
+
+void log_arg(LogRecord& record, const int32_t& value);
+void log_arg(LogRecord& record, const uint32_t& value);
+void log_arg(LogRecord& record, const float& value);
+void log_arg(LogRecord& record, const char* value);
+
+
+/* Narrower integers, longs and doubles funnel into the four above */
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value>::type
+log_arg(LogRecord& record, const T& value)
+{
+        if (std::is_signed<T>::value) {
+                log_arg(record, (int32_t)value);
+        } else {
+                log_arg(record, (uint32_t)value);
+        }
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+log_arg(LogRecord& record, const T& value)
+{
+        log_arg(record, (float)value);
+}
+
+template <size_t N>
+void log_arg(LogRecord& record, const char (&value)[N])
+{
+        log_arg(record, (const char*)value);
+}
+
+inline void log_arg(LogRecord& record, char* value)
+{
+        log_arg(record, (const char*)value);
+}
+
+
+/* Build the record and send it in one write */
+template <typename... Args>
+void log_tokens(const uint32_t& token, const Args&... args)
+{
+        LogRecord record(token, sizeof...(Args));
+        int expand[] = { 0, (log_arg(record, args), 0)... };
+        (void)expand;
+        log_write(record.data, record.len);
+}
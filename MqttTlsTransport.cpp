@@ -0,0 +1,31 @@
+#include "MqttTlsTransport.hpp"
+
+/* MqttTlsTransport constructor - parse the certificates once. */
+MqttTlsTransport::MqttTlsTransport(
+        const char* aws_endpoint_in,
+        const char* root_ca_pem,
+        const char* client_cert_pem,
+        const char* client_key_pem,
+        const uint16_t& port_in
+)
+        : MqttTransport(aws_endpoint_in, port_in)
+        , tls_client()
+        , trust_anchors(root_ca_pem)
+        , client_cert(client_cert_pem)
+        , client_key(client_key_pem)
+{
+}
+
+
+/* Offer the last session, if any, and connect */
+int MqttTlsTransport::_open(const char* host, uint16_t port)
+{
+        tls_client.stop();
+        tls_client.setBufferSizes(MQTT_TLS_RX_BUFFER, MQTT_TLS_TX_BUFFER);
+        tls_client.setTrustAnchors(&trust_anchors);
+        tls_client.setClientRSACert(&client_cert, &client_key);
+        tls_client.setX509Time(time(nullptr));
+        tls_sessions.apply(tls_client);
+
+        return tls_client.connect(host, port);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <WiFiClientSecureBearSSL.h>
+
+#include "MqttTransport.hpp"
+
+/* MQTT over TLS Definitions */
+#define MQTT_TLS_PORT                   8883
+// BearSSL buffers - AWS IoT packets are small, so keep these tight
+#define MQTT_TLS_RX_BUFFER              2048
+#define MQTT_TLS_TX_BUFFER              1024
+
+
+/*
+ * MQTT straight over TLS on 8883, authenticated with an X.509 client
+ * certificate from AWS IoT.  No WebSocket framing and no SigV4, and since
+ * we own the TLS client, reconnects resume the last TLS session.
+ *
+ * The certificates are checked against the clock, so set the time (e.g.
+ * configTime()) before connecting.
+ */
+class MqttTlsTransport : public MqttTransport {
+public:
+        MqttTlsTransport(
+                const char* aws_endpoint_in,
+                const char* root_ca_pem,
+                const char* client_cert_pem,
+                const char* client_key_pem,
+                const uint16_t& port_in=MQTT_TLS_PORT
+        );
+
+        virtual const char* name() const { return "mqtts"; }
+
+protected:
+        virtual Client& _stream() { return tls_client; }
+        virtual int _open(const char* host, uint16_t port);
+
+private:
+        BearSSL::WiFiClientSecure       tls_client;
+        BearSSL::X509List               trust_anchors;
+        BearSSL::X509List               client_cert;
+        BearSSL::PrivateKey             client_key;
+};
@@ -0,0 +1,150 @@
+#include "MqttTransport.hpp"
+
+/* MqttTransport constructor - remember where we're going. */
+MqttTransport::MqttTransport(const char* host_in, const uint16_t& port_in)
+        : tls_sessions()
+        , host_name(host_in)
+        , host_port(port_in)
+        , input_paused(false)
+{
+        memset(&counters, 0, sizeof(counters));
+        tls_sessions.begin();
+}
+
+
+/* We always need the host name for TLS - connect by name only */
+int MqttTransport::connect(IPAddress ip, uint16_t port)
+{
+        (void)ip;
+        (void)port;
+        return 0;
+}
+
+
+/*
+ * Open the backend's connection and time it.  TLS and WebSocket libraries
+ * allocate their buffers per connection, so they may use the heap here.
+ */
+int MqttTransport::connect(const char* host, uint16_t port)
+{
+        HeapSealExemption handshake_allocations;
+
+        uint32_t start = millis();
+        int rc = _open(host, port);
+        if (rc != 1) {
+                counters.connect_failures++;
+                return rc;
+        }
+        counters.connects++;
+        tls_sessions.handshake_done(millis() - start);
+        return rc;
+}
+
+
+size_t MqttTransport::write(uint8_t b)
+{
+        return write(&b, 1);
+}
+
+
+/*
+ * Paho writes one whole packet per call.  lwIP allocates the segments it
+ * queues, so writes get a pass from the heap seal.
+ */
+size_t MqttTransport::write(const uint8_t* buf, size_t size)
+{
+        HeapSealExemption segment_allocations;
+
+        size_t written = _stream().write(buf, size);
+        if (written > 0) {
+                counters.writes++;
+                counters.bytes_out += written;
+        }
+        return written;
+}
+
+
+int MqttTransport::available()
+{
+        if (input_paused) {
+                return 0;
+        }
+        return _stream().available();
+}
+
+
+int MqttTransport::read()
+{
+        if (input_paused) {
+                return -1;
+        }
+        int c = _stream().read();
+        if (c >= 0) {
+                counters.bytes_in++;
+        }
+        return c;
+}
+
+
+int MqttTransport::read(uint8_t* buf, size_t size)
+{
+        if (input_paused) {
+                return 0;
+        }
+        int got = _stream().read(buf, size);
+        if (got > 0) {
+                counters.bytes_in += got;
+        }
+        return got;
+}
+
+
+int MqttTransport::peek()
+{
+        if (input_paused) {
+                return -1;
+        }
+        return _stream().peek();
+}
+
+
+void MqttTransport::flush()
+{
+        _stream().flush();
+}
+
+
+void MqttTransport::stop()
+{
+        _stream().stop();
+}
+
+
+uint8_t MqttTransport::connected()
+{
+        return _stream().connected();
+}
+
+
+MqttTransport::operator bool()
+{
+        return connected();
+}
+
+
+/* Serialize the byte counts - see the header for the format */
+size_t MqttTransport::to_json(char* buffer, const size_t& buffer_len) const
+{
+        int used = snprintf_P(
+                buffer,
+                buffer_len,
+                PSTR("\"tx\":[\"%s\",%u,%u]"),
+                name(),
+                counters.writes,
+                counters.bytes_out
+        );
+        if (used < 0) {
+                return 0;
+        }
+        return (size_t)used < buffer_len ? used : buffer_len;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+#include "TlsSessionCache.hpp"
+#include "HeapMetrics.hpp"
+
+/* MQTT Transport Definitions */
+// Longest to_json() output, longest backend name, with its terminator
+#define TRANSPORT_JSON_LEN              \
+        sizeof("\"tx\":[\"mqtts\",4294967295,4294967295]")
+
+/* Counters for bytes through a transport - they only go up */
+struct TransportStats {
+        /* MQTT packets written and their bytes */
+        uint32_t        writes;
+        uint32_t        bytes_out;
+
+        /* MQTT bytes read */
+        uint32_t        bytes_in;
+
+        uint32_t        connects;
+        uint32_t        connect_failures;
+};
+
+
+/*
+ * An MqttTransport is the byte stream Paho runs on - it is a Client, so
+ * Paho's IPStack wraps it like any other.  Each backend opens its own kind
+ * of connection; the base class counts bytes and times connects so the
+ * backends can be compared on the same terms.
+ *
+ * What the TLS and WebSocket framing adds per packet, and what each
+ * backend's connect costs, is measured on the host against a loopback
+ * broker - see test/test_transports.cpp.
+ *
+ * Backends are WebSocketTransport (WSS on 443, signed with SigV4) and
+ * MqttTlsTransport (MQTT straight over TLS on 8883, X.509 client cert).
+ */
+class MqttTransport : public Client {
+public:
+        MqttTransport(const char* host_in, const uint16_t& port_in);
+        virtual ~MqttTransport() {}
+
+        /* Where connect() goes */
+        const char* host() const { return host_name; }
+        uint16_t port() const { return host_port; }
+
+        /* Short name for logs */
+        virtual const char* name() const = 0;
+
+        /* Client interface - forwarded to the backend, with counting */
+        virtual int connect(IPAddress ip, uint16_t port);
+        virtual int connect(const char* host, uint16_t port);
+        virtual size_t write(uint8_t b);
+        virtual size_t write(const uint8_t* buf, size_t size);
+        virtual int available();
+        virtual int read();
+        virtual int read(uint8_t* buf, size_t size);
+        virtual int peek();
+        virtual void flush();
+        virtual void stop();
+        virtual uint8_t connected();
+        virtual operator bool();
+
+        /*
+         * While input is paused the transport reports nothing to read, so
+         * Paho stops between packets.  Anything unread waits in the socket.
+         */
+        void pause_input(const bool& paused) { input_paused = paused; }
+
+        const TransportStats& stats() const { return counters; }
+
+        /*
+         * Serialize as a member for the metrics object:
+         *   "tx":[<name>,writes,bytes]
+         */
+        size_t to_json(char* buffer, const size_t& buffer_len) const;
+
+        /* Connect timings, full vs. resumed TLS */
+        const HandshakeStats& handshake_stats() const
+        {
+                return tls_sessions.stats();
+        }
+
+protected:
+        /* The client the backend reads and writes through */
+        virtual Client& _stream() = 0;
+
+        /* Bring the connection up.  Returns 1 on success, like Client. */
+        virtual int _open(const char* host, uint16_t port) = 0;
+
+        TlsSessionCache                 tls_sessions;
+
+private:
+        const char*                     host_name;
+        uint16_t                        host_port;
+        bool                            input_paused;
+
+        TransportStats                  counters;
+};
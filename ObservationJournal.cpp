@@ -0,0 +1,129 @@
+#include "ObservationJournal.hpp"
+#include "HeapMetrics.hpp"
+
+/* ObservationJournal constructor - SPIFFS waits for begin(). */
+ObservationJournal::ObservationJournal()
+        : started(false)
+        , read_offset(sizeof(uint32_t))
+        , sample_count(0)
+{
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/* Append samples, creating the file (and its header) if needed */
+bool ObservationJournal::append(
+        const TelemetrySample* samples,
+        const uint8_t& count
+)
+{
+        if (!started or sample_count + count > JOURNAL_MAX_SAMPLES) {
+                counters.dropped_full += count;
+                return false;
+        }
+
+        HeapSealExemption file_allocations;
+        bool fresh = !SPIFFS.exists(JOURNAL_FILE);
+        File f = SPIFFS.open(JOURNAL_FILE, "a");
+        if (!f) {
+                counters.dropped_full += count;
+                return false;
+        }
+        if (fresh) {
+                read_offset = sizeof(read_offset);
+                f.write((const uint8_t*)&read_offset, sizeof(read_offset));
+        }
+        f.write((const uint8_t*)samples, count * sizeof(TelemetrySample));
+        f.close();
+
+        sample_count += count;
+        counters.appended += count;
+        return true;
+}
+
+
+/* Read the oldest samples without consuming them */
+uint8_t ObservationJournal::peek(
+        TelemetrySample* samples,
+        const uint8_t& max_count
+)
+{
+        if (!started or sample_count == 0) {
+                return 0;
+        }
+
+        HeapSealExemption file_allocations;
+        File f = SPIFFS.open(JOURNAL_FILE, "r");
+        if (!f or !f.seek(read_offset, SeekSet)) {
+                return 0;
+        }
+        uint8_t count = max_count < sample_count ? max_count : sample_count;
+        size_t got = f.read((uint8_t*)samples, count * sizeof(TelemetrySample));
+        f.close();
+        return got / sizeof(TelemetrySample);
+}
+
+
+/*
+ * Move the read offset past published samples.  Once everything is read
+ * the file goes, so the next outage starts from an empty journal.
+ */
+void ObservationJournal::consume(const uint8_t& count)
+{
+        if (count == 0 or sample_count == 0) {
+                return;
+        }
+
+        uint8_t done = count < sample_count ? count : sample_count;
+        sample_count -= done;
+        counters.replayed += done;
+
+        HeapSealExemption file_allocations;
+        if (sample_count == 0) {
+                SPIFFS.remove(JOURNAL_FILE);
+                read_offset = sizeof(read_offset);
+                return;
+        }
+
+        read_offset += done * sizeof(TelemetrySample);
+        File f = SPIFFS.open(JOURNAL_FILE, "r+");
+        if (f) {
+                f.write((const uint8_t*)&read_offset, sizeof(read_offset));
+                f.close();
+        }
+}
+
+
+/*
+ * Mount SPIFFS and read the header of any journal we find.  This can't
+ * happen in a global constructor - SPIFFS isn't ready yet - and it can't
+ * wait for first use, which comes after the heap is sealed.
+ */
+bool ObservationJournal::begin()
+{
+        if (started) {
+                return true;
+        }
+        if (!SPIFFS.begin()) {
+                return false;
+        }
+        started = true;
+
+        File f = SPIFFS.open(JOURNAL_FILE, "r");
+        if (!f) {
+                return true;
+        }
+        uint32_t offset = 0;
+        if (f.read((uint8_t*)&offset, sizeof(offset)) == sizeof(offset) and
+            offset >= sizeof(offset) and
+            offset <= f.size()
+        ) {
+                read_offset = offset;
+                sample_count = (f.size() - offset) / sizeof(TelemetrySample);
+        }
+        f.close();
+        if (sample_count == 0) {
+                SPIFFS.remove(JOURNAL_FILE);
+        }
+        return true;
+}
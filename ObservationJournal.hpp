@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+/* Observation Journal Definitions */
+#define JOURNAL_FILE                    "/history.bin"
+// 2048 samples is over 4 days at one sample every 3 minutes (~24 KB)
+#define JOURNAL_MAX_SAMPLES             2048
+
+/*
+ *  Packed telemetry sample.  We keep fixed point integers rather than
+ *  floats so a batch serializes without dtostrf() and stays small on the
+ *  wire.
+ *
+ *  4 + 2 + 2 + 2 = 10 Bytes (12 with padding) each.
+ */
+struct TelemetrySample {
+        /* Epoch time of the observation */
+        int32_t         epoch;
+
+        /* Temperature in hundredths of a degree Celsius */
+        int16_t         temperature_c100;
+
+        /* Humidity in hundredths of a percent */
+        uint16_t        humidity_c100;
+
+        /* Sea level pressure in tenths of a hPa */
+        uint16_t        pressure_d10;
+};
+
+
+/* Counters for the journal - they only go up */
+struct JournalStats {
+        uint32_t        appended;
+        uint32_t        replayed;
+        uint32_t        dropped_full;
+};
+
+
+/*
+ * The ObservationJournal is our history store on SPIFFS: samples we
+ * couldn't publish are appended while we're offline and read back, oldest
+ * first, once we're connected again.
+ *
+ * The file starts with the offset of the first unread sample, rewritten as
+ * samples are consumed, so the history survives a reset.  Delivery is
+ * at-least-once - a reset between publishing and consume() replays that
+ * batch.  Past JOURNAL_MAX_SAMPLES new samples are counted and dropped.
+ *
+ * SPIFFS allocates: mounting keeps its work buffers, and every open()
+ * makes a file object that close() frees again.  So begin() has to run
+ * in setup(), before the heap is sealed, and the file operations after
+ * that run under a HeapSealExemption.
+ */
+class ObservationJournal {
+public:
+        ObservationJournal();
+
+        /*
+         * Mount SPIFFS and pick up a journal left over from before a
+         * reset.  Call from setup() - without it nothing is kept.
+         */
+        bool begin();
+
+        /* Add samples to the end of the journal */
+        bool append(const TelemetrySample* samples, const uint8_t& count);
+
+        /* Copy up to max_count of the oldest samples, without removing them */
+        uint8_t peek(TelemetrySample* samples, const uint8_t& max_count);
+
+        /* Drop the count oldest samples - they've been published */
+        void consume(const uint8_t& count);
+
+        /* Samples waiting in the journal */
+        uint16_t pending() const { return sample_count; }
+
+        const JournalStats& stats() const { return counters; }
+
+private:
+        bool                            started;
+        uint32_t                        read_offset;
+        uint16_t                        sample_count;
+        JournalStats                    counters;
+};
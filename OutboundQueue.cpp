@@ -0,0 +1,452 @@
+#include "TwilioLambdaHelper.hpp"
+
+#if OUTBOUND_SPILL_TO_FLASH == 1
+#include <FS.h>
+#endif
+
+/* RAM slot quota for each class */
+static const uint8_t class_slots[OUTBOUND_CLASSES] = {
+        OUTBOUND_ALERT_SLOTS,
+        OUTBOUND_ALARM_SLOTS,
+        OUTBOUND_REPLY_SLOTS,
+        OUTBOUND_SHADOW_SLOTS,
+        OUTBOUND_TELEMETRY_SLOTS
+};
+
+/* Sends per drain round for each class */
+static const uint8_t class_burst[OUTBOUND_CLASSES] = {
+        OUTBOUND_ALERT_BURST,
+        OUTBOUND_ALARM_BURST,
+        OUTBOUND_REPLY_BURST,
+        OUTBOUND_SHADOW_BURST,
+        OUTBOUND_TELEMETRY_BURST
+};
+
+
+/* OutboundQueue constructor - empty queue, zeroed counters. */
+OutboundQueue::OutboundQueue()
+        : spilled_total(0)
+        , spill_offset(0)
+        , spill_head_class(OUTBOUND_CLASSES)
+{
+        memset(in_use, 0, sizeof(in_use));
+        memset(head, 0, sizeof(head));
+        memset(count, 0, sizeof(count));
+        memset(spilled_count, 0, sizeof(spilled_count));
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/*
+ * Add a message to the tail of its class.  It has to fit in one MQTT
+ * packet along with its topic - anything bigger would only ever fail.
+ */
+bool OutboundQueue::push(
+        const OutboundPriority& priority,
+        const char* topic,
+        const char* payload
+)
+{
+        if (strlen(topic) >= OUTBOUND_MAX_TOPIC_LEN or
+            strlen(payload) > mqtt_payload_room(topic)
+        ) {
+                counters.dropped_oversize++;
+                counters.classes[priority].dropped++;
+                return false;
+        }
+
+        // Keep ordering - once a class has spilled, everything in it goes to
+        // flash until RAM has caught up.
+        int8_t slot = _free_slot();
+        if (slot < 0 and
+            spilled_count[priority] == 0 and
+            count[priority] < class_slots[priority]
+        ) {
+                slot = _evict(priority);
+        }
+        if (spilled_count[priority] == 0 and
+            count[priority] < class_slots[priority] and
+            slot >= 0
+        ) {
+                _fill(slots[slot], topic, payload, millis());
+                in_use[slot] = true;
+                uint8_t tail =
+                        (head[priority] + count[priority]) %
+                        OUTBOUND_QUEUE_DEPTH;
+                order[priority][tail] = slot;
+                count[priority]++;
+                counters.classes[priority].enqueued++;
+                return true;
+        }
+
+        if (_spill(priority, topic, payload, millis())) {
+                counters.classes[priority].enqueued++;
+                counters.spilled++;
+                return true;
+        }
+
+        counters.dropped_full++;
+        counters.classes[priority].dropped++;
+        return false;
+}
+
+
+/* Return the head of a class if its backoff has elapsed */
+OutboundMessage* OutboundQueue::due(const OutboundPriority& priority)
+{
+        if (count[priority] == 0) {
+                return NULL;
+        }
+
+        OutboundMessage& msg = slots[order[priority][head[priority]]];
+        if ((int32_t)(millis() - msg.next_attempt) < 0) {
+                return NULL;
+        }
+        return &msg;
+}
+
+
+/* Remove the head of a class after a successful send */
+void OutboundQueue::pop(const OutboundPriority& priority)
+{
+        if (count[priority] == 0) {
+                return;
+        }
+
+        OutboundMessage& msg = slots[order[priority][head[priority]]];
+        _record_latency(priority, millis() - msg.enqueued_at);
+        _remove_head(priority);
+        _unspill();
+}
+
+
+/* Exponential backoff on the head of a class after a failed send */
+void OutboundQueue::defer(const OutboundPriority& priority)
+{
+        if (count[priority] == 0) {
+                return;
+        }
+
+        OutboundMessage& msg = slots[order[priority][head[priority]]];
+        uint32_t backoff = OUTBOUND_RETRY_BASE;
+        for (uint8_t i = 0; i < msg.attempts and backoff < OUTBOUND_RETRY_MAX;
+             ++i) {
+                backoff *= 2;
+        }
+        if (backoff > OUTBOUND_RETRY_MAX) {
+                backoff = OUTBOUND_RETRY_MAX;
+        }
+
+        msg.attempts++;
+        msg.next_attempt = millis() + backoff;
+        counters.retries++;
+}
+
+
+/* Stale messages (a six hour old weather report) are worse than none */
+void OutboundQueue::expire()
+{
+        for (uint8_t c = 0; c < OUTBOUND_CLASSES; ++c) {
+                OutboundPriority priority = (OutboundPriority)c;
+                while (count[c] > 0 and
+                       millis() - slots[order[c][head[c]]].enqueued_at >
+                       OUTBOUND_MAX_AGE
+                ) {
+                        _remove_head(priority);
+                        counters.dropped_expired++;
+                        counters.classes[c].dropped++;
+                }
+        }
+        _unspill();
+}
+
+
+/* A message that went straight out still counts toward class latency */
+void OutboundQueue::record_direct(
+        const OutboundPriority& priority,
+        const uint32_t& latency
+)
+{
+        counters.classes[priority].enqueued++;
+        _record_latency(priority, latency);
+}
+
+
+/* Total messages waiting */
+uint8_t OutboundQueue::depth() const
+{
+        uint8_t total = spilled_total;
+        for (uint8_t c = 0; c < OUTBOUND_CLASSES; ++c) {
+                total += count[c];
+        }
+        return total;
+}
+
+
+/* Messages waiting in one class */
+uint8_t OutboundQueue::depth(const OutboundPriority& priority) const
+{
+        return count[priority] + spilled_count[priority];
+}
+
+
+/* Messages that would go out before a new message of this class */
+uint8_t OutboundQueue::depth_at_or_above(
+        const OutboundPriority& priority
+) const
+{
+        uint8_t total = 0;
+        for (uint8_t c = 0; c <= priority; ++c) {
+                total += count[c] + spilled_count[c];
+        }
+        return total;
+}
+
+
+/* How long the oldest head has been waiting */
+uint32_t OutboundQueue::oldest_age() const
+{
+        uint32_t oldest = 0;
+        for (uint8_t c = 0; c < OUTBOUND_CLASSES; ++c) {
+                if (count[c] == 0) {
+                        continue;
+                }
+                uint32_t age = millis() - slots[order[c][head[c]]].enqueued_at;
+                if (age > oldest) {
+                        oldest = age;
+                }
+        }
+        return oldest;
+}
+
+
+/* Messages a class may send per drain round */
+uint8_t OutboundQueue::burst(const OutboundPriority& priority)
+{
+        return class_burst[priority];
+}
+
+
+/* Copy a message into a slot */
+void OutboundQueue::_fill(
+        OutboundMessage& msg,
+        const char* topic,
+        const char* payload,
+        const uint32_t& enqueued_at
+)
+{
+        msg.enqueued_at = enqueued_at;
+        msg.next_attempt = 0;
+        msg.attempts = 0;
+        strncpy(msg.topic, topic, OUTBOUND_MAX_TOPIC_LEN - 1);
+        msg.topic[OUTBOUND_MAX_TOPIC_LEN - 1] = '\0';
+        strncpy(msg.payload, payload, maxMQTTpackageSize - 1);
+        msg.payload[maxMQTTpackageSize - 1] = '\0';
+}
+
+
+/* Release the head slot of a class */
+void OutboundQueue::_remove_head(const OutboundPriority& priority)
+{
+        in_use[order[priority][head[priority]]] = false;
+        head[priority] = (head[priority] + 1) % OUTBOUND_QUEUE_DEPTH;
+        count[priority]--;
+}
+
+
+/* Enqueue-to-send time for a class */
+void OutboundQueue::_record_latency(
+        const OutboundPriority& priority,
+        const uint32_t& latency
+)
+{
+        OutboundClassStats& cls = counters.classes[priority];
+        cls.sent++;
+        cls.latency_total += latency;
+        if (latency > cls.latency_max) {
+                cls.latency_max = latency;
+        }
+}
+
+
+/* Index of an unused slot, or -1 */
+int8_t OutboundQueue::_free_slot() const
+{
+        for (uint8_t i = 0; i < OUTBOUND_QUEUE_DEPTH; ++i) {
+                if (!in_use[i]) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+
+/*
+ * The pool is full but this class is under its quota: take the slot of the
+ * youngest message in the least urgent class below it.  That message goes
+ * to flash, or is dropped if its class already has messages there - it is
+ * older than those, and appending it would send it out of order.  Returns
+ * the freed slot, or -1 if only this class or more urgent ones hold slots.
+ */
+int8_t OutboundQueue::_evict(const OutboundPriority& priority)
+{
+        for (uint8_t c = OUTBOUND_CLASSES - 1; c > priority; --c) {
+                if (count[c] == 0) {
+                        continue;
+                }
+
+                OutboundPriority victim = (OutboundPriority)c;
+                uint8_t tail = (head[c] + count[c] - 1) % OUTBOUND_QUEUE_DEPTH;
+                uint8_t slot = order[c][tail];
+                OutboundMessage& msg = slots[slot];
+                if (spilled_count[c] == 0 and
+                    _spill(victim, msg.topic, msg.payload, msg.enqueued_at)
+                ) {
+                        counters.spilled++;
+                } else {
+                        counters.dropped_full++;
+                        counters.classes[c].dropped++;
+                }
+                counters.evicted++;
+
+                in_use[slot] = false;
+                count[c]--;
+                return slot;
+        }
+        return -1;
+}
+
+
+/*
+ * Append a message to the spill file.  Records are:
+ *      [enqueued_at:4][class:1][topic_len:1][payload_len:2][topic][payload]
+ */
+bool OutboundQueue::_spill(
+        const OutboundPriority& priority,
+        const char* topic,
+        const char* payload,
+        const uint32_t& enqueued_at
+)
+{
+#if OUTBOUND_SPILL_TO_FLASH == 1
+        if (spilled_total == 255) {
+                return false;
+        }
+
+        // SPIFFS allocates a file object per open() - a short-lived one.
+        HeapSealExemption file_allocations;
+
+        // Starting a new spill truncates anything left over from before a
+        // reset - those timestamps no longer mean anything.
+        if (spilled_total == 0 and !SPIFFS.begin()) {
+                return false;
+        }
+        File f = SPIFFS.open(OUTBOUND_SPILL_FILE, spilled_total ? "a" : "w");
+        if (!f) {
+                return false;
+        }
+
+        uint8_t cls = priority;
+        uint8_t topic_len = strlen(topic);
+        uint16_t payload_len = strlen(payload);
+        if (f.size() + 8 + topic_len + payload_len >
+            OUTBOUND_SPILL_MAX_BYTES
+        ) {
+                f.close();
+                return false;
+        }
+
+        f.write((const uint8_t*)&enqueued_at, sizeof(enqueued_at));
+        f.write(&cls, sizeof(cls));
+        f.write(&topic_len, sizeof(topic_len));
+        f.write((const uint8_t*)&payload_len, sizeof(payload_len));
+        f.write((const uint8_t*)topic, topic_len);
+        f.write((const uint8_t*)payload, payload_len);
+        f.close();
+
+        if (spilled_total == 0) {
+                spill_head_class = priority;
+        }
+        spilled_count[priority]++;
+        spilled_total++;
+        return true;
+#else
+        return false;
+#endif
+}
+
+
+/*
+ * Pull spilled messages back into RAM, oldest first, while their class has
+ * room.  The file is a single FIFO, so a full class holds up the records
+ * behind it until it drains.
+ *
+ * We're called on every pop() and expire(), so remember whose record is
+ * next and only open the file when it could come in.
+ */
+void OutboundQueue::_unspill()
+{
+#if OUTBOUND_SPILL_TO_FLASH == 1
+        if (spilled_total == 0 or _free_slot() < 0) {
+                return;
+        }
+        if (spill_head_class < OUTBOUND_CLASSES and
+            count[spill_head_class] >= class_slots[spill_head_class]
+        ) {
+                return;
+        }
+
+        HeapSealExemption file_allocations;
+        File f = SPIFFS.open(OUTBOUND_SPILL_FILE, "r");
+        if (!f or !f.seek(spill_offset, SeekSet)) {
+                // Lost the file - nothing more we can do for these.
+                counters.dropped_full += spilled_total;
+                memset(spilled_count, 0, sizeof(spilled_count));
+                spilled_total = 0;
+                spill_offset = 0;
+                spill_head_class = OUTBOUND_CLASSES;
+                return;
+        }
+
+        while (spilled_total > 0) {
+                uint32_t enqueued_at;
+                uint8_t cls;
+                uint8_t topic_len;
+                uint16_t payload_len;
+                f.read((uint8_t*)&enqueued_at, sizeof(enqueued_at));
+                f.read(&cls, sizeof(cls));
+                f.read(&topic_len, sizeof(topic_len));
+                f.read((uint8_t*)&payload_len, sizeof(payload_len));
+
+                spill_head_class = cls;
+                int8_t slot = _free_slot();
+                if (slot < 0 or count[cls] >= class_slots[cls]) {
+                        break;
+                }
+
+                OutboundMessage& msg = slots[slot];
+                msg.enqueued_at = enqueued_at;
+                msg.next_attempt = 0;
+                msg.attempts = 0;
+                f.read((uint8_t*)msg.topic, topic_len);
+                msg.topic[topic_len] = '\0';
+                f.read((uint8_t*)msg.payload, payload_len);
+                msg.payload[payload_len] = '\0';
+
+                in_use[slot] = true;
+                order[cls][(head[cls] + count[cls]) % OUTBOUND_QUEUE_DEPTH] =
+                        slot;
+                count[cls]++;
+                spilled_count[cls]--;
+                spilled_total--;
+                spill_offset += 8 + topic_len + payload_len;
+        }
+        f.close();
+
+        if (spilled_total == 0) {
+                SPIFFS.remove(OUTBOUND_SPILL_FILE);
+                spill_offset = 0;
+                spill_head_class = OUTBOUND_CLASSES;
+        }
+#endif
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <Arduino.h>
+
+extern const int maxMQTTpackageSize;
+
+/* Outbound Queue Definitions */
+// Messages held in RAM while we wait for a connection (shared by classes)
+#define OUTBOUND_QUEUE_DEPTH            6
+// Longest topic we will hold on to
+#define OUTBOUND_MAX_TOPIC_LEN          64
+// First retry after 1 second, doubling up to 2 minutes
+#define OUTBOUND_RETRY_BASE             1000
+#define OUTBOUND_RETRY_MAX              (2*60*1000)
+// Give up on anything older than 6 hours
+#define OUTBOUND_MAX_AGE                (6*60*60*1000)
+// Spill to SPIFFS when the RAM queue fills - set to 0 to stay in RAM
+#define OUTBOUND_SPILL_TO_FLASH         1
+#define OUTBOUND_SPILL_FILE             "/outbound.q"
+#define OUTBOUND_SPILL_MAX_BYTES        (16*1024)
+
+// Most RAM slots each class may hold, so a backlog of bulk traffic can't
+// crowd out the urgent classes.
+#define OUTBOUND_ALERT_SLOTS            6
+#define OUTBOUND_ALARM_SLOTS            4
+#define OUTBOUND_REPLY_SLOTS            4
+#define OUTBOUND_SHADOW_SLOTS           2
+#define OUTBOUND_TELEMETRY_SLOTS        2
+
+// Messages each class may send per round of draining.  Rounds go in
+// priority order, so urgent classes always go first but lower classes still
+// make progress after a reconnect.
+#define OUTBOUND_ALERT_BURST            4
+#define OUTBOUND_ALARM_BURST            2
+#define OUTBOUND_REPLY_BURST            2
+#define OUTBOUND_SHADOW_BURST           1
+#define OUTBOUND_TELEMETRY_BURST        1
+
+
+/* Outbound traffic classes, most urgent first */
+enum OutboundPriority {
+        OUTBOUND_ALERT = 0,
+        OUTBOUND_ALARM,
+        OUTBOUND_REPLY,
+        OUTBOUND_SHADOW,
+        OUTBOUND_TELEMETRY,
+        OUTBOUND_CLASSES
+};
+
+
+/* One pending publish */
+struct OutboundMessage {
+        /* millis() when first queued */
+        uint32_t        enqueued_at;
+
+        /* millis() before which we shouldn't try again */
+        uint32_t        next_attempt;
+
+        /* Failed publishes so far */
+        uint8_t         attempts;
+
+        char            topic[OUTBOUND_MAX_TOPIC_LEN];
+        char            payload[maxMQTTpackageSize];
+};
+
+
+/* Per class counters, including enqueue-to-send latency in milliseconds */
+struct OutboundClassStats {
+        uint32_t        enqueued;
+        uint32_t        sent;
+        uint32_t        dropped;
+        uint32_t        latency_total;
+        uint32_t        latency_max;
+};
+
+
+/* Counters for the outbound queue - they only go up */
+struct OutboundStats {
+        OutboundClassStats      classes[OUTBOUND_CLASSES];
+        uint32_t                retries;
+        uint32_t                dropped_full;
+        uint32_t                dropped_expired;
+        uint32_t                dropped_oversize;
+        uint32_t                spilled;
+        uint32_t                evicted;
+};
+
+
+/*
+ * A bounded, prioritized queue of publishes we couldn't send yet.
+ *
+ * The queue itself only holds messages and schedules retries; the
+ * TwilioLambdaHelper does the publishing.  Each OutboundPriority class is
+ * its own FIFO over a shared pool of slots, capped at the class' _SLOTS
+ * quota.  Within a class messages leave in the order they arrived, and a
+ * failing head blocks the rest of its class.  The quotas add up to more
+ * than the pool, so when it is full a class under its quota evicts the
+ * youngest message of the least urgent class below it - an alarm never
+ * waits behind telemetry.
+ *
+ * When OUTBOUND_SPILL_TO_FLASH is set, messages that don't fit in RAM are
+ * appended to a file on SPIFFS and pulled back in as slots free up.  Once
+ * a class has anything on flash, its new messages go there too so order is
+ * kept.  SPIFFS is mounted in setup() (see ObservationJournal), and the
+ * file operations are exempt from the heap seal.
+ */
+class OutboundQueue {
+public:
+        OutboundQueue();
+
+        /* Queue a message.  Returns false if it had to be dropped. */
+        bool push(
+                const OutboundPriority& priority,
+                const char* topic,
+                const char* payload
+        );
+
+        /* Oldest message in a class, if it is due for a (re)try */
+        OutboundMessage* due(const OutboundPriority& priority);
+
+        /* The head of a class was sent - remove it */
+        void pop(const OutboundPriority& priority);
+
+        /* The head of a class failed - back it off */
+        void defer(const OutboundPriority& priority);
+
+        /* Drop anything that has waited longer than OUTBOUND_MAX_AGE */
+        void expire();
+
+        /* Count a message that skipped the queue entirely */
+        void record_direct(
+                const OutboundPriority& priority,
+                const uint32_t& latency
+        );
+
+        /* Messages in RAM and on flash */
+        uint8_t depth() const;
+        uint8_t depth(const OutboundPriority& priority) const;
+
+        /* Messages waiting in this class or a more urgent one */
+        uint8_t depth_at_or_above(const OutboundPriority& priority) const;
+
+        /* Age in milliseconds of the oldest message, 0 if empty */
+        uint32_t oldest_age() const;
+
+        /* Messages a class may send per drain round */
+        static uint8_t burst(const OutboundPriority& priority);
+
+        const OutboundStats& stats() const { return counters; }
+
+private:
+        void _fill(
+                OutboundMessage& msg,
+                const char* topic,
+                const char* payload,
+                const uint32_t& enqueued_at
+        );
+        void _remove_head(const OutboundPriority& priority);
+        void _record_latency(
+                const OutboundPriority& priority,
+                const uint32_t& latency
+        );
+        int8_t _free_slot() const;
+        int8_t _evict(const OutboundPriority& priority);
+        bool _spill(
+                const OutboundPriority& priority,
+                const char* topic,
+                const char* payload,
+                const uint32_t& enqueued_at
+        );
+        void _unspill();
+
+        /* Shared slot pool */
+        OutboundMessage                 slots[OUTBOUND_QUEUE_DEPTH];
+        bool                            in_use[OUTBOUND_QUEUE_DEPTH];
+
+        /* Per class FIFOs of slot indices */
+        uint8_t         order[OUTBOUND_CLASSES][OUTBOUND_QUEUE_DEPTH];
+        uint8_t         head[OUTBOUND_CLASSES];
+        uint8_t         count[OUTBOUND_CLASSES];
+
+        /* Messages on flash, and where the next one starts */
+        uint8_t         spilled_count[OUTBOUND_CLASSES];
+        uint8_t         spilled_total;
+        uint32_t        spill_offset;
+
+        /* Class of the next message on flash, OUTBOUND_CLASSES if unknown */
+        uint8_t         spill_head_class;
+
+        OutboundStats                   counters;
+};
@@ -0,0 +1,132 @@
+#include "Profiler.hpp"
+
+#if PROFILING == 1
+
+#include "Log.hpp"
+
+// Ticks per second of profile_clock()
+#ifdef ARDUINO
+#define PROFILE_CLOCK_HZ                (F_CPU)
+#else
+#define PROFILE_CLOCK_HZ                1000000000UL
+#endif
+
+static ProfileEntry profile_table[PROFILE_MARKERS];
+
+static const char* const profile_names[PROFILE_MARKERS] = {
+        "make_observation",
+        "get_weather_report",
+        "report_shadow_state",
+        "twilio_handler",
+        "shadow_handler",
+        "delta_handler",
+        "ntp_update",
+        "handleRequests"
+};
+
+
+void profile_record(const ProfileMarker& marker, const uint32_t& ticks)
+{
+        ProfileEntry& entry = profile_table[marker];
+        entry.calls++;
+        entry.total += ticks;
+        if (ticks > entry.max) {
+                entry.max = ticks;
+        }
+}
+
+
+const ProfileEntry& profile_entry(const ProfileMarker& marker)
+{
+        return profile_table[marker];
+}
+
+
+const char* profile_name(const ProfileMarker& marker)
+{
+        return profile_names[marker];
+}
+
+
+void profile_reset()
+{
+        memset(profile_table, 0, sizeof(profile_table));
+}
+
+
+/* Clock ticks to microseconds */
+static uint32_t ticks_to_us(const uint64_t& ticks)
+{
+        return (uint32_t)(ticks * 1000000 / PROFILE_CLOCK_HZ);
+}
+
+
+/* Average per call, in microseconds */
+static uint32_t average_us(const ProfileEntry& entry)
+{
+        return ticks_to_us(entry.total / entry.calls);
+}
+
+
+/* Times in microseconds, so the lines read the same on board and host */
+void profile_log()
+{
+        for (uint8_t i = 0; i < PROFILE_MARKERS; ++i) {
+                const ProfileEntry& entry = profile_table[i];
+                if (entry.calls == 0) {
+                        continue;
+                }
+                LOG_INFO(
+                        LOG_SYSTEM,
+                        "%-20s %6u calls, %8u us avg, %8u us max",
+                        profile_names[i],
+                        entry.calls,
+                        average_us(entry),
+                        ticks_to_us(entry.max)
+                );
+        }
+}
+
+
+/* Serialize the table - see the header for the format */
+size_t profile_to_json(char* buffer, const size_t& buffer_len)
+{
+        int len = snprintf_P(buffer, buffer_len, PSTR("{\"us\":["));
+        if (len < 0 or (size_t)len >= buffer_len) {
+                return buffer_len;
+        }
+        size_t used = len;
+
+        // Each marker has to leave room for the closing ']}'.
+        bool first = true;
+        for (uint8_t i = 0; i < PROFILE_MARKERS; ++i) {
+                const ProfileEntry& entry = profile_table[i];
+                if (entry.calls == 0) {
+                        continue;
+                }
+                len = snprintf_P(
+                        buffer + used,
+                        buffer_len - used,
+                        PSTR("%s[\"%s\",%u,%u,%u]"),
+                        first ? "" : ",",
+                        profile_names[i],
+                        entry.calls,
+                        average_us(entry),
+                        ticks_to_us(entry.max)
+                );
+                if (len < 0 or used + len + 3 > buffer_len) {
+                        buffer[used] = '\0';
+                        break;
+                }
+                used += len;
+                first = false;
+        }
+
+        if (used + 3 > buffer_len) {
+                return buffer_len;
+        }
+        used += snprintf_P(buffer + used, buffer_len - used, PSTR("]}"));
+        return used;
+}
+
+#endif
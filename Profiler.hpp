@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+ * Set to 1 to time the markers below.  At 0 every PROFILE_SCOPE() is
+ * empty and the table isn't compiled in at all.
+ */
+#ifndef PROFILING
+#define PROFILING                       0
+#endif
+
+
+/* Everything we time - add a name to profile_names[] for each new marker */
+enum ProfileMarker {
+        PROFILE_MAKE_OBSERVATION = 0,
+        PROFILE_WEATHER_REPORT,
+        PROFILE_REPORT_SHADOW,
+        PROFILE_TWILIO_HANDLER,
+        PROFILE_SHADOW_HANDLER,
+        PROFILE_DELTA_HANDLER,
+        PROFILE_NTP_UPDATE,
+        PROFILE_HANDLE_REQUESTS,
+        PROFILE_MARKERS
+};
+
+
+#if PROFILING == 1
+
+#ifndef ARDUINO
+#include <chrono>
+#endif
+
+/* Totals for one marker */
+struct ProfileEntry {
+        uint32_t        calls;
+        uint64_t        total;
+        uint32_t        max;
+};
+
+
+/*
+ * Now, in clock ticks - CPU cycles on the board (12.5 ns at 80 MHz), and
+ * nanoseconds from a steady clock on the host.  Either wraps, so only
+ * differences are meaningful and a single scope must stay under ~50 s.
+ */
+inline uint32_t profile_clock()
+{
+#ifdef ARDUINO
+        return ESP.getCycleCount();
+#else
+        return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+#endif
+}
+
+
+/* Add one timed call to a marker */
+void profile_record(const ProfileMarker& marker, const uint32_t& ticks);
+
+/* The table, and a printable name for each marker */
+const ProfileEntry& profile_entry(const ProfileMarker& marker);
+const char* profile_name(const ProfileMarker& marker);
+
+/* Zero every marker */
+void profile_reset();
+
+/* One LOG_INFO line per marker that has been called */
+void profile_log();
+
+/*
+ * Serialize for MQTT, times in microseconds:
+ *   {"us":[[<name>,calls,average,max],..]}
+ * Markers that don't fit in buffer_len are left off.
+ */
+size_t profile_to_json(char* buffer, const size_t& buffer_len);
+
+
+/*
+ * Times the rest of the enclosing block against a marker.  Cheap enough
+ * for anything that runs once per loop() - two clock reads and an add.
+ */
+class ProfileScope {
+public:
+        explicit ProfileScope(const ProfileMarker& marker_in)
+                : marker(marker_in)
+                , start(profile_clock())
+        {
+        }
+
+        ~ProfileScope()
+        {
+                profile_record(marker, profile_clock() - start);
+        }
+
+private:
+        ProfileMarker                   marker;
+        uint32_t                        start;
+};
+
+#define PROFILE_SCOPE(marker)           ProfileScope profile_scope(marker)
+
+#else
+
+#define PROFILE_SCOPE(marker)           do {} while (0)
+
+#endif
@@ -0,0 +1,80 @@
+#include "ReplyCoalescer.hpp"
+
+/* ReplyCoalescer constructor - nobody is waiting yet. */
+ReplyCoalescer::ReplyCoalescer(
+        const char* twilio_topic_in,
+        TwilioLambdaHelper& lambdaHelperIn
+)
+        : lambdaHelper(lambdaHelperIn)
+        , twilio_topic(twilio_topic_in)
+        , recipient_count(0)
+        , window_start(0)
+{
+        device_number[0] = '\0';
+}
+
+
+/* Add a sender to the current batch, opening a window if needed */
+bool ReplyCoalescer::add_request(
+        const char* from_number,
+        const char* device_number_in
+)
+{
+        // They're already getting this report.
+        for (uint8_t i = 0; i < recipient_count; ++i) {
+                if (strcmp(recipients[i], from_number) == 0) {
+                        return true;
+                }
+        }
+
+        if (recipient_count >= COALESCE_MAX_RECIPIENTS or
+            strlen(from_number) >= E164_MAX_LEN or
+            strlen(device_number_in) >= E164_MAX_LEN
+        ) {
+                return false;
+        }
+
+        if (recipient_count == 0) {
+                window_start = millis();
+                strcpy(device_number, device_number_in);
+        }
+
+        strcpy(recipients[recipient_count++], from_number);
+        return true;
+}
+
+
+/* A batch goes out when it fills or its window closes */
+bool ReplyCoalescer::due() const
+{
+        if (recipient_count == 0) {
+                return false;
+        }
+        return recipient_count >= COALESCE_MAX_RECIPIENTS or
+               millis() - window_start >= COALESCE_WINDOW;
+}
+
+
+/* Publish one message with every waiting recipient */
+void ReplyCoalescer::flush(const char* report)
+{
+        if (recipient_count == 0) {
+                return;
+        }
+
+        const char* to_numbers[COALESCE_MAX_RECIPIENTS];
+        for (uint8_t i = 0; i < recipient_count; ++i) {
+                to_numbers[i] = recipients[i];
+        }
+
+        lambdaHelper.send_twilio_broadcast(
+                twilio_topic,
+                to_numbers,
+                recipient_count,
+                device_number,
+                report,
+                OUTBOUND_REPLY
+        );
+
+        recipient_count = 0;
+}
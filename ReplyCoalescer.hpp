@@ -0,0 +1,59 @@
+#pragma once
+
+#include "TwilioLambdaHelper.hpp"
+
+/* Reply Coalescing Definitions */
+// How long to collect requests after the first one arrives
+#define COALESCE_WINDOW                 2000
+// Most recipients in one outgoing message - keep under maxMQTTpackageSize
+#define COALESCE_MAX_RECIPIENTS         10
+
+
+/*
+ * The ReplyCoalescer collects the senders of weather requests that arrive
+ * close together - a group chat, or a broadcast to the station's number -
+ * so we render the report once and publish a single 'Outgoing' message
+ * carrying every recipient.  The Lambda function on the other side expands
+ * the 'To' list into individual SMSes.
+ *
+ * Requests are held for at most COALESCE_WINDOW after the first one, or
+ * until COALESCE_MAX_RECIPIENTS are waiting.  Repeat senders inside the
+ * window only get one reply.
+ */
+class ReplyCoalescer {
+public:
+        ReplyCoalescer(
+                const char* twilio_topic_in,
+                TwilioLambdaHelper& lambdaHelperIn
+        );
+
+        /*
+         * Remember a sender to reply to from our device number.  Returns
+         * false if the batch is full and the caller should reply directly.
+         */
+        bool add_request(
+                const char* from_number,
+                const char* device_number_in
+        );
+
+        /* Is a batch waiting and ready to go? */
+        bool due() const;
+
+        /* Send one report to everyone waiting */
+        void flush(const char* report);
+
+        /* Senders waiting on the current batch */
+        uint8_t pending() const { return recipient_count; }
+
+private:
+        TwilioLambdaHelper&             lambdaHelper;
+        const char*                     twilio_topic;
+
+        /* Who is waiting, and which of our numbers they texted */
+        char            recipients[COALESCE_MAX_RECIPIENTS][E164_MAX_LEN];
+        uint8_t         recipient_count;
+        char            device_number[E164_MAX_LEN];
+
+        /* millis() when the first request of this batch arrived */
+        uint32_t        window_start;
+};
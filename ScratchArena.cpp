@@ -0,0 +1,80 @@
+#include "ScratchArena.hpp"
+#include "Log.hpp"
+
+ScratchArena scratch;
+
+
+/* ScratchArena constructor - empty. */
+ScratchArena::ScratchArena()
+        : top(0)
+{
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/* Round up to the next SCRATCH_ALIGN boundary and bump */
+void* ScratchArena::alloc(const size_t& size)
+{
+        size_t start = (top + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+        if (start > SCRATCH_ARENA_SIZE or size > SCRATCH_ARENA_SIZE - start) {
+                counters.failures++;
+                LOG_WARN(
+                        LOG_SYSTEM,
+                        "Scratch arena full, %u bytes in use, %u wanted",
+                        (unsigned)top,
+                        (unsigned)size
+                );
+                return NULL;
+        }
+
+        top = start + size;
+        if (top > counters.high_water) {
+                counters.high_water = top;
+        }
+        return memory + start;
+}
+
+
+char* ScratchArena::copy(const char* text, const size_t& len)
+{
+        char* copied = alloc<char>(len + 1);
+        if (copied != NULL) {
+                memcpy(copied, text, len);
+                copied[len] = '\0';
+        }
+        return copied;
+}
+
+
+/* Only ever moves the top down - a stale mark can't hand memory out twice */
+void ScratchArena::release(const size_t& mark_in)
+{
+        if (mark_in < top) {
+                top = mark_in;
+        }
+}
+
+
+void ScratchArena::reset()
+{
+        top = 0;
+        counters.resets++;
+}
+
+
+/* Serialize the stats - see the header for the format */
+size_t ScratchArena::to_json(char* buffer, const size_t& buffer_len) const
+{
+        int used = snprintf_P(
+                buffer,
+                buffer_len,
+                PSTR("{\"size\":%u,\"max\":%u,\"fail\":%u}"),
+                SCRATCH_ARENA_SIZE,
+                (unsigned)counters.high_water,
+                (unsigned)counters.failures
+        );
+        if (used < 0) {
+                return 0;
+        }
+        return (size_t)used < buffer_len ? used : buffer_len;
+}
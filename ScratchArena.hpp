@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/* Scratch Arena Definitions */
+// Room for the deepest handler: a parsed message, a report and the reply
+#define SCRATCH_ARENA_SIZE              2048
+// Every allocation starts on this boundary - enough for any type we use
+#define SCRATCH_ALIGN                   8
+
+
+/* How full the arena has been - they only go up */
+struct ScratchStats {
+        /* Most bytes in use at once */
+        uint32_t        high_water;
+
+        /* Allocations that didn't fit */
+        uint32_t        failures;
+
+        /* Work items the arena was reset after */
+        uint32_t        resets;
+};
+
+
+/*
+ * ScratchArena is a fixed block of memory handed out by bumping a pointer,
+ * for everything a handler needs only until it returns: JSON documents,
+ * reply text, serialized payloads.  Nothing is freed piecemeal.  A
+ * ScratchScope gives back everything allocated inside it, and reset() at
+ * the end of each work item empties the arena, so it can never fragment.
+ *
+ * There is one arena, 'scratch', shared by everything on the loop() side.
+ * It isn't safe to use from an interrupt, or from the MQTT callbacks while
+ * loop() code is holding memory in it.
+ */
+class ScratchArena {
+public:
+        ScratchArena();
+
+        /* Aligned room for size bytes, or NULL if the arena is full */
+        void* alloc(const size_t& size);
+
+        /* Room for count Ts - not constructed, so keep to plain types */
+        template <typename T>
+        T* alloc(const size_t& count=1)
+        {
+                return static_cast<T*>(alloc(sizeof(T) * count));
+        }
+
+        /* Copy a string in, or NULL if it doesn't fit */
+        char* copy(const char* text, const size_t& len);
+
+        /* Everything allocated since mark() was taken goes back */
+        size_t mark() const { return top; }
+        void release(const size_t& mark_in);
+
+        /* Empty the arena - call when a work item is done */
+        void reset();
+
+        size_t used() const { return top; }
+        const ScratchStats& stats() const { return counters; }
+
+        /* Serialize for the metrics topic: {"size":..,"max":..,"fail":..} */
+        size_t to_json(char* buffer, const size_t& buffer_len) const;
+
+private:
+        alignas(SCRATCH_ALIGN) uint8_t  memory[SCRATCH_ARENA_SIZE];
+        size_t                          top;
+        ScratchStats                    counters;
+};
+
+
+/* The arena everything on the loop() side shares */
+extern ScratchArena scratch;
+
+
+/* Releases everything allocated in the enclosing block when it ends */
+class ScratchScope {
+public:
+        ScratchScope() : saved(scratch.mark()) {}
+        ~ScratchScope() { scratch.release(saved); }
+
+private:
+        size_t                          saved;
+};
+
+
+/*
+ * An ArduinoJson (5.13) buffer whose nodes come straight out of the arena -
+ * use it like a StaticJsonBuffer, inside a ScratchScope.  There's no fixed
+ * capacity: a document can use whatever the arena has left, and once it's
+ * full parsing and creating fail as they would with a full StaticJsonBuffer.
+ */
+class ScratchJsonBuffer
+        : public ArduinoJson::Internals::JsonBufferBase<ScratchJsonBuffer> {
+public:
+        virtual void* alloc(size_t bytes) { return scratch.alloc(bytes); }
+};
@@ -0,0 +1,113 @@
+#include "SenderRateLimiter.hpp"
+
+/* SenderRateLimiter constructor - all slots empty. */
+SenderRateLimiter::SenderRateLimiter()
+{
+        memset(buckets, 0, sizeof(buckets));
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/* Find (or make) the sender's bucket and try to take a token */
+bool SenderRateLimiter::allow(const char* e164_number)
+{
+        uint32_t now = millis();
+        uint64_t key = hash_number(e164_number);
+        uint8_t start = key & (RATE_LIMIT_TABLE_SIZE - 1);
+
+        Bucket* found = NULL;
+        Bucket* empty = NULL;
+        Bucket* oldest = NULL;
+        for (uint8_t i = 0; i < RATE_LIMIT_PROBE_LIMIT; ++i) {
+                Bucket& b = buckets[(start + i) & (RATE_LIMIT_TABLE_SIZE - 1)];
+                if (b.key == key) {
+                        found = &b;
+                        break;
+                }
+                if (b.key == 0) {
+                        if (empty == NULL) {
+                                empty = &b;
+                        }
+                        continue;
+                }
+                if (oldest == NULL or
+                    now - b.last_seen > now - oldest->last_seen
+                ) {
+                        oldest = &b;
+                }
+        }
+
+        if (found == NULL) {
+                if (empty != NULL) {
+                        found = empty;
+                } else {
+                        found = oldest;
+                        counters.evictions++;
+                }
+                found->key = key;
+                found->last_refill = now;
+                found->tokens = RATE_LIMIT_BURST;
+        }
+
+        found->last_seen = now;
+        _refill(*found, now);
+
+        if (found->tokens == 0) {
+                counters.dropped++;
+                return false;
+        }
+        found->tokens--;
+        counters.allowed++;
+        return true;
+}
+
+
+/* Hash a phone number into a table key.  0 is reserved for 'empty'. */
+uint64_t SenderRateLimiter::hash_number(const char* e164_number)
+{
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (const char* p = e164_number; *p; ++p) {
+                hash ^= (uint8_t)*p;
+                hash *= 0x100000001b3ULL;
+        }
+        return hash ? hash : 1;
+}
+
+
+/* Serialize the counters - see the header for the format */
+size_t SenderRateLimiter::to_json(
+        char* buffer,
+        const size_t& buffer_len
+) const
+{
+        int used = snprintf_P(
+                buffer,
+                buffer_len,
+                PSTR("\"rl\":[%u,%u,%u]"),
+                counters.allowed,
+                counters.dropped,
+                counters.evictions
+        );
+        if (used < 0) {
+                return 0;
+        }
+        return (size_t)used < buffer_len ? used : buffer_len;
+}
+
+
+/* Add a token for every RATE_LIMIT_REFILL that has passed */
+void SenderRateLimiter::_refill(Bucket& bucket, const uint32_t& now)
+{
+        uint32_t earned = (now - bucket.last_refill) / RATE_LIMIT_REFILL;
+        if (earned == 0) {
+                return;
+        }
+
+        if (bucket.tokens + earned >= RATE_LIMIT_BURST) {
+                bucket.tokens = RATE_LIMIT_BURST;
+                bucket.last_refill = now;
+        } else {
+                bucket.tokens += earned;
+                bucket.last_refill += earned * RATE_LIMIT_REFILL;
+        }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+
+/* Rate Limiting Definitions */
+// Senders we track at once - must be a power of two
+#define RATE_LIMIT_TABLE_SIZE           32
+// Slots we look at before evicting - keeps lookups O(1)
+#define RATE_LIMIT_PROBE_LIMIT          4
+// Each sender may burst this many requests...
+#define RATE_LIMIT_BURST                3
+// ...then gets one more every 20 seconds
+#define RATE_LIMIT_REFILL               (20*1000)
+// Longest to_json() output, with its terminator
+#define RATE_LIMIT_JSON_LEN             \
+        sizeof("\"rl\":[4294967295,4294967295,4294967295]")
+
+
+/* Counters for the rate limiter - they only go up */
+struct RateLimitStats {
+        uint32_t        allowed;
+        uint32_t        dropped;
+        uint32_t        evictions;
+};
+
+
+/*
+ * The SenderRateLimiter keeps a token bucket for each number that texts the
+ * station, so one sender can't make us render and send a report a hundred
+ * times a minute.
+ *
+ * Buckets live in a fixed-size open addressing table keyed by a 64 bit hash
+ * of the E.164 number - no heap, and no strings kept around.  Linear probing
+ * stops after RATE_LIMIT_PROBE_LIMIT slots; if none of them is free the
+ * least recently seen of those slots is evicted.
+ */
+class SenderRateLimiter {
+public:
+        SenderRateLimiter();
+
+        /* Take a token for this sender.  False means drop the request. */
+        bool allow(const char* e164_number);
+
+        const RateLimitStats& stats() const { return counters; }
+
+        /*
+         * Serialize as a member for the metrics object:
+         *   "rl":[allowed,dropped,evictions]
+         */
+        size_t to_json(char* buffer, const size_t& buffer_len) const;
+
+        /* 64 bit FNV-1a */
+        static uint64_t hash_number(const char* e164_number);
+
+private:
+        struct Bucket {
+                /* Hash of the sender, 0 when the slot is empty */
+                uint64_t        key;
+
+                /* millis() we last heard from them, for eviction */
+                uint32_t        last_seen;
+
+                /* millis() the last token was added */
+                uint32_t        last_refill;
+
+                uint8_t         tokens;
+        };
+
+        void _refill(Bucket& bucket, const uint32_t& now);
+
+        Bucket                          buckets[RATE_LIMIT_TABLE_SIZE];
+        RateLimitStats                  counters;
+};
@@ -0,0 +1,226 @@
+#include "SigV4Presigner.hpp"
+
+/* SHA-256 of an empty payload, hex */
+static const char empty_payload_hash[] =
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+
+/* SigV4Presigner constructor - no key until the first presign(). */
+SigV4Presigner::SigV4Presigner(
+        const char* aws_region_in,
+        const char* aws_key_in,
+        const char* aws_secret_in
+)
+        : aws_region(aws_region_in)
+        , aws_key(aws_key_in)
+        , aws_secret(aws_secret_in)
+{
+        key_date[0] = '\0';
+        path[0] = '\0';
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/*
+ * Build '/mqtt?<query>&X-Amz-Signature=<sig>'.  Only the host header is
+ * signed and the payload is empty, so the canonical request is short.  The
+ * WebSocket library sends 'Host: <host>:<port>', so that's what we sign.
+ */
+const char* SigV4Presigner::presign(
+        const char* host,
+        const uint16_t& port,
+        const time_t& now
+)
+{
+        // Nothing from an earlier call survives a failure - the library
+        // may still be pointing at this buffer.
+        path[0] = '\0';
+
+        // Before NTP answers we'd sign for 1970 - AWS would only say no.
+        if (now < 1500000000) {
+                return NULL;
+        }
+        uint32_t start = micros();
+
+        struct tm utc;
+        gmtime_r(&now, &utc);
+        char date[SIGV4_DATE_LEN];
+        char amz_date[17];
+        strftime(date, sizeof(date), "%Y%m%d", &utc);
+        strftime(amz_date, sizeof(amz_date), "%Y%m%dT%H%M%SZ", &utc);
+
+        if (strcmp(date, key_date) != 0) {
+                _derive_signing_key(date);
+        }
+
+        // Canonical query string - keys in order, the credential encoded.
+        int query_len = snprintf_P(
+                path,
+                sizeof(path),
+                PSTR("/mqtt?X-Amz-Algorithm=AWS4-HMAC-SHA256"
+                     "&X-Amz-Credential=%s%%2F%s%%2F%s%%2F" SIGV4_SERVICE
+                     "%%2Faws4_request"
+                     "&X-Amz-Date=%s"
+                     "&X-Amz-SignedHeaders=host"),
+                aws_key,
+                date,
+                aws_region,
+                amz_date
+        );
+        // Room for '&X-Amz-Signature=' and 64 hex digits
+        if (query_len < 0 or query_len + 17 + 64 >= (int)sizeof(path)) {
+                path[0] = '\0';
+                return NULL;
+        }
+        const char* query = path + 6;
+
+        // Hash the canonical request as it streams by - no buffer for it.
+        br_sha256_context sha;
+        br_sha256_init(&sha);
+        br_sha256_update(&sha, "GET\n/mqtt\n", 10);
+        br_sha256_update(&sha, query, strlen(query));
+        br_sha256_update(&sha, "\nhost:", 6);
+        br_sha256_update(&sha, host, strlen(host));
+        char port_str[7];
+        int port_len = snprintf_P(
+                port_str,
+                sizeof(port_str),
+                PSTR(":%u"),
+                port
+        );
+        br_sha256_update(&sha, port_str, port_len);
+        br_sha256_update(&sha, "\n\nhost\n", 7);
+        br_sha256_update(&sha, empty_payload_hash, 64);
+        uint8_t digest[32];
+        br_sha256_out(&sha, digest);
+        char request_hash[65];
+        _to_hex(digest, sizeof(digest), request_hash);
+
+        strcpy(path + query_len, "&X-Amz-Signature=");
+        if (!sign(
+                signing_key,
+                amz_date,
+                aws_region,
+                SIGV4_SERVICE,
+                request_hash,
+                path + query_len + 17
+        )) {
+                path[0] = '\0';
+                return NULL;
+        }
+
+        counters.signs++;
+        counters.last_sign_us = micros() - start;
+        if (counters.last_sign_us > counters.max_sign_us) {
+                counters.max_sign_us = counters.last_sign_us;
+        }
+        return path;
+}
+
+
+/* Cache the key for a new day */
+void SigV4Presigner::_derive_signing_key(const char* date)
+{
+        derive_signing_key(
+                aws_secret,
+                date,
+                aws_region,
+                SIGV4_SERVICE,
+                signing_key
+        );
+        strcpy(key_date, date);
+        counters.key_derivations++;
+}
+
+
+/* kSigning = HMAC(HMAC(HMAC(HMAC("AWS4" + secret, date), region), service),
+ * "aws4_request") */
+void SigV4Presigner::derive_signing_key(
+        const char* secret,
+        const char* date,
+        const char* region,
+        const char* service,
+        uint8_t* key_out
+)
+{
+        char secret_key[64];
+        int secret_len = snprintf_P(
+                secret_key,
+                sizeof(secret_key),
+                PSTR("AWS4%s"),
+                secret
+        );
+        if (secret_len < 0 or secret_len >= (int)sizeof(secret_key)) {
+                secret_len = sizeof(secret_key) - 1;
+        }
+
+        uint8_t k[32];
+        _hmac((const uint8_t*)secret_key, secret_len, date, strlen(date), k);
+        _hmac(k, sizeof(k), region, strlen(region), k);
+        _hmac(k, sizeof(k), service, strlen(service), k);
+        _hmac(k, sizeof(k), "aws4_request", 12, key_out);
+
+        memset(secret_key, 0, sizeof(secret_key));
+}
+
+
+/* HMAC the string to sign - its scope date is the day of amz_date */
+bool SigV4Presigner::sign(
+        const uint8_t* signing_key,
+        const char* amz_date,
+        const char* region,
+        const char* service,
+        const char* request_hash,
+        char* signature_out
+)
+{
+        char string_to_sign[160];
+        int sts_len = snprintf_P(
+                string_to_sign,
+                sizeof(string_to_sign),
+                PSTR("AWS4-HMAC-SHA256\n%s\n%.8s/%s/%s/aws4_request\n%s"),
+                amz_date,
+                amz_date,
+                region,
+                service,
+                request_hash
+        );
+        if (sts_len < 0 or sts_len >= (int)sizeof(string_to_sign)) {
+                return false;
+        }
+
+        uint8_t signature[32];
+        _hmac(signing_key, 32, string_to_sign, sts_len, signature);
+        _to_hex(signature, sizeof(signature), signature_out);
+        return true;
+}
+
+
+/* HMAC-SHA256 through BearSSL.  out may alias key. */
+void SigV4Presigner::_hmac(
+        const uint8_t* key,
+        const size_t& key_len,
+        const char* data,
+        const size_t& data_len,
+        uint8_t* out
+)
+{
+        br_hmac_key_context key_ctx;
+        br_hmac_key_init(&key_ctx, &br_sha256_vtable, key, key_len);
+        br_hmac_context ctx;
+        br_hmac_init(&ctx, &key_ctx, 0);
+        br_hmac_update(&ctx, data, data_len);
+        br_hmac_out(&ctx, out);
+}
+
+
+/* Lower case hex, NUL terminated - out needs 2*len + 1 bytes */
+void SigV4Presigner::_to_hex(const uint8_t* data, const size_t& len, char* out)
+{
+        static const char digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; ++i) {
+                out[2*i] = digits[data[i] >> 4];
+                out[2*i + 1] = digits[data[i] & 0x0f];
+        }
+        out[2*len] = '\0';
+}
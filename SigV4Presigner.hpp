@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+#include <bearssl/bearssl.h>
+
+/* SigV4 Definitions */
+// AWS IoT's service name for presigned WebSocket URLs
+#define SIGV4_SERVICE                   "iotdevicegateway"
+// Longest presigned path we build
+#define SIGV4_PATH_LEN                  320
+// 'YYYYMMDD' plus the terminator
+#define SIGV4_DATE_LEN                  9
+
+
+/* Counters for signing - they only go up (except the timings) */
+struct SigV4Stats {
+        uint32_t        signs;
+        uint32_t        key_derivations;
+        uint32_t        last_sign_us;
+        uint32_t        max_sign_us;
+};
+
+
+/*
+ * The SigV4Presigner builds the presigned '/mqtt?...' path AWS IoT expects
+ * on a WebSocket upgrade.
+ *
+ * The signing key is four chained HMAC-SHA256s over the secret, date,
+ * region and service - but it only depends on the date.  We derive it once
+ * per UTC day and every later connect that day only hashes the canonical
+ * request and runs one more HMAC.
+ *
+ * Times come from time(), so set the clock (configTime()) before signing.
+ */
+class SigV4Presigner {
+public:
+        SigV4Presigner(
+                const char* aws_region_in,
+                const char* aws_key_in,
+                const char* aws_secret_in
+        );
+
+        /*
+         * Presign a connection to host:port for the time now.  Returns the
+         * path, valid until the next call, or NULL if the clock isn't set.
+         * After a NULL the old path is gone too.
+         */
+        const char* presign(
+                const char* host,
+                const uint16_t& port,
+                const time_t& now
+        );
+
+        const SigV4Stats& stats() const { return counters; }
+
+        /*
+         * The two SigV4 steps presign() is made of, for any service - so
+         * they can be checked against AWS's published examples.
+         *
+         * derive_signing_key() writes the 32 byte kSigning for a day
+         * ('YYYYMMDD').  sign() writes the 64 hex digit signature of a
+         * canonical request, given its hex SHA-256; false if the string
+         * to sign doesn't fit.
+         */
+        static void derive_signing_key(
+                const char* secret,
+                const char* date,
+                const char* region,
+                const char* service,
+                uint8_t* key_out
+        );
+        static bool sign(
+                const uint8_t* signing_key,
+                const char* amz_date,
+                const char* region,
+                const char* service,
+                const char* request_hash,
+                char* signature_out
+        );
+
+private:
+        void _derive_signing_key(const char* date);
+        static void _hmac(
+                const uint8_t* key,
+                const size_t& key_len,
+                const char* data,
+                const size_t& data_len,
+                uint8_t* out
+        );
+        static void _to_hex(const uint8_t* data, const size_t& len, char* out);
+
+        /* AWS Settings */
+        const char*                     aws_region;
+        const char*                     aws_key;
+        const char*                     aws_secret;
+
+        /* Day the cached key is for, and the key itself */
+        char                            key_date[SIGV4_DATE_LEN];
+        uint8_t                         signing_key[32];
+
+        char                            path[SIGV4_PATH_LEN];
+
+        SigV4Stats                      counters;
+};
@@ -0,0 +1,186 @@
+#include "StackMonitor.hpp"
+#include "Log.hpp"
+
+#ifdef ARDUINO
+// The continuation loop() runs on - see cont.h
+extern "C" cont_t* g_pcont;
+#else
+#include <assert.h>
+#endif
+
+static StackStats stack_counters;
+
+/* Lowest and one past the highest word of the stack, once we've begun */
+static volatile uint32_t* stack_bottom = NULL;
+static volatile uint32_t* stack_top = NULL;
+
+/* Innermost StackScope that is running */
+static StackScope* current_scope = NULL;
+
+static const char* const stack_probe_names[STACK_PROBES] = {
+        "twilio_handler",
+        "delta_handler",
+        "report_shadow_state",
+        "update_shadow_state"
+};
+
+
+/*
+ * Paint from the bottom of the stack up to a little below our own frame.
+ * Never inlined, so the frame we measure from is this one and not our
+ * caller's.
+ */
+static void __attribute__((noinline)) stack_paint()
+{
+        volatile uint32_t* limit = (volatile uint32_t*)(
+                (uint8_t*)__builtin_frame_address(0) - STACK_PAINT_MARGIN
+        );
+        for (volatile uint32_t* word = stack_bottom; word < limit; ++word) {
+                *word = STACK_PAINT_PATTERN;
+        }
+}
+
+
+/* Bytes from the top of the stack down to the lowest word in use */
+static uint16_t stack_depth()
+{
+        if (stack_bottom == NULL) {
+                return 0;
+        }
+        const volatile uint32_t* word = stack_bottom;
+        while (word < stack_top and *word == STACK_PAINT_PATTERN) {
+                ++word;
+        }
+        return (uint8_t*)stack_top - (uint8_t*)word;
+}
+
+
+void stack_begin()
+{
+#ifdef ARDUINO
+        stack_bottom = g_pcont->stack;
+        stack_top = g_pcont->stack + STACK_SIZE / sizeof(uint32_t);
+#else
+        stack_top = (volatile uint32_t*)__builtin_frame_address(0);
+        stack_bottom = stack_top - STACK_SIZE / sizeof(uint32_t);
+#endif
+        memset(&stack_counters, 0, sizeof(stack_counters));
+        stack_paint();
+}
+
+
+void stack_sample()
+{
+        uint16_t depth = stack_depth();
+        if (depth > stack_counters.deepest) {
+                stack_counters.deepest = depth;
+        }
+}
+
+
+const StackStats& stack_stats()
+{
+        return stack_counters;
+}
+
+
+const char* stack_probe_name(const StackProbe& probe)
+{
+        return stack_probe_names[probe];
+}
+
+
+/* Serialize the stats - see the header for the format */
+size_t stack_to_json(char* buffer, const size_t& buffer_len)
+{
+        int len = snprintf_P(
+                buffer,
+                buffer_len,
+                PSTR("{\"size\":%u,\"budget\":%u,\"max\":%u,\"over\":%u,"
+                     "\"hw\":["),
+                STACK_SIZE,
+                STACK_HANDLER_BUDGET,
+                stack_counters.deepest,
+                stack_counters.over_budget
+        );
+        if (len < 0 or (size_t)len >= buffer_len) {
+                return buffer_len;
+        }
+        size_t used = len;
+
+        // Each probe has to leave room for the closing ']}'.
+        for (uint8_t i = 0; i < STACK_PROBES; ++i) {
+                len = snprintf_P(
+                        buffer + used,
+                        buffer_len - used,
+                        PSTR("%s[\"%s\",%u]"),
+                        i == 0 ? "" : ",",
+                        stack_probe_names[i],
+                        stack_counters.high_water[i]
+                );
+                if (len < 0 or used + len + 3 > buffer_len) {
+                        buffer[used] = '\0';
+                        break;
+                }
+                used += len;
+        }
+
+        if (used + 3 > buffer_len) {
+                return buffer_len;
+        }
+        used += snprintf_P(buffer + used, buffer_len - used, PSTR("]}"));
+        return used;
+}
+
+
+/* Save what the outer scope has seen, then repaint for ourselves */
+StackScope::StackScope(const StackProbe& probe_in)
+        : probe(probe_in)
+        , deepest(0)
+        , outer(current_scope)
+{
+        if (outer != NULL) {
+                uint16_t depth = stack_depth();
+                if (depth > outer->deepest) {
+                        outer->deepest = depth;
+                }
+        }
+        current_scope = this;
+        if (stack_bottom != NULL) {
+                stack_paint();
+        }
+}
+
+
+/* Record the deepest point, check it against the budget, pass it up */
+StackScope::~StackScope()
+{
+        uint16_t depth = stack_depth();
+        if (depth > deepest) {
+                deepest = depth;
+        }
+        current_scope = outer;
+        if (outer != NULL and deepest > outer->deepest) {
+                outer->deepest = deepest;
+        }
+
+        if (deepest > stack_counters.high_water[probe]) {
+                stack_counters.high_water[probe] = deepest;
+        }
+        if (deepest > stack_counters.deepest) {
+                stack_counters.deepest = deepest;
+        }
+        if (deepest > STACK_HANDLER_BUDGET) {
+                stack_counters.over_budget++;
+                LOG_WARN(
+                        LOG_SYSTEM,
+                        "%s used %u bytes of stack, over the %u budget",
+                        stack_probe_names[probe],
+                        deepest,
+                        STACK_HANDLER_BUDGET
+                );
+#ifndef ARDUINO
+                assert(deepest <= STACK_HANDLER_BUDGET);
+#endif
+        }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <Arduino.h>
+
+/* Stack Monitor Definitions */
+// loop() runs on the core's 4 KiB continuation stack - the host build
+// pretends to have one the same size
+#ifdef ARDUINO
+#include <cont.h>
+#define STACK_SIZE                      CONT_STACKSIZE
+#define STACK_PAINT_PATTERN             CONT_STACKGUARD
+#else
+#define STACK_SIZE                      4096
+#define STACK_PAINT_PATTERN             0xfeefeffe
+#endif
+// Deepest a handler may take the stack, counted from the top.  Over it we
+// log and count on the board, and assert on the host.
+#ifndef STACK_HANDLER_BUDGET
+#define STACK_HANDLER_BUDGET            3072
+#endif
+// Left unpainted just below the painting code's own frame
+#define STACK_PAINT_MARGIN              64
+
+
+/* Everything we measure - add a name to stack_probe_names[] for each */
+enum StackProbe {
+        STACK_TWILIO_HANDLER = 0,
+        STACK_DELTA_HANDLER,
+        STACK_REPORT_SHADOW,
+        STACK_UPDATE_SHADOW,
+        STACK_PROBES
+};
+
+
+/* Stack depths in bytes from the top of the stack */
+struct StackStats {
+        /* Deepest seen anywhere since stack_begin() */
+        uint16_t        deepest;
+
+        /* Deepest while each probe was running */
+        uint16_t        high_water[STACK_PROBES];
+
+        /* Probe runs that went past STACK_HANDLER_BUDGET */
+        uint32_t        over_budget;
+};
+
+
+/*
+ * Paint the unused stack with STACK_PAINT_PATTERN - first thing in setup().
+ * On the host the top of the stack is taken to be here.
+ */
+void stack_begin();
+
+/* Fold the deepest point since the last paint into the stats */
+void stack_sample();
+
+const StackStats& stack_stats();
+const char* stack_probe_name(const StackProbe& probe);
+
+/*
+ * Serialize for the metrics topic:
+ *   {"size":..,"budget":..,"max":..,"over":..,"hw":[[<name>,depth],..]}
+ */
+size_t stack_to_json(char* buffer, const size_t& buffer_len);
+
+
+/*
+ * Measures how deep the stack goes while the enclosing block runs.  The
+ * constructor repaints everything below it, and the destructor looks for
+ * the lowest word that no longer holds the pattern.
+ *
+ * Scopes nest - an inner scope hands what it saw up to the outer one,
+ * since its repaint wipes the outer scope's marks.  Painting is a pass
+ * over at most STACK_SIZE bytes, so keep these to handlers, not loops.
+ */
+class StackScope {
+public:
+        explicit StackScope(const StackProbe& probe_in);
+        ~StackScope();
+
+private:
+        StackProbe                      probe;
+        uint16_t                        deepest;
+        StackScope*                     outer;
+};
+
+#define STACK_SCOPE(probe)              StackScope stack_scope(probe)
@@ -0,0 +1,244 @@
+#include "TelemetryBatcher.hpp"
+
+/* TelemetryBatcher constructor - start with an empty batch. */
+TelemetryBatcher::TelemetryBatcher(
+        const char* telemetry_topic_in,
+        TwilioLambdaHelper& lambdaHelperIn
+)
+        : lambdaHelper(lambdaHelperIn)
+        , journal()
+        , last_replay(0)
+        , replay_started(0)
+        , replay_samples(0)
+        , telemetry_topic(telemetry_topic_in)
+        , sample_count(0)
+        , first_sample_time(0)
+{
+        memset(&recovery, 0, sizeof(recovery));
+}
+
+
+/* Pack an observation into the batch, and send the batch when it fills */
+void TelemetryBatcher::add_observation(
+        const int32_t& epoch,
+        const float& temperature,
+        const float& humidity,
+        const float& pressure
+)
+{
+        // flush() always empties the batch, but never write past the end.
+        if (sample_count >= TELEMETRY_BATCH_SIZE) {
+                flush();
+        }
+        if (sample_count == 0) {
+                first_sample_time = millis();
+        }
+
+        TelemetrySample& sample = samples[sample_count++];
+        sample.epoch = epoch;
+        sample.temperature_c100 = (int16_t)round(temperature * 100);
+        sample.humidity_c100 = (uint16_t)round(humidity * 100);
+        sample.pressure_d10 = (uint16_t)round(pressure * 10);
+
+        if (sample_count >= TELEMETRY_BATCH_SIZE) {
+                flush();
+        }
+}
+
+
+/*
+ * Age trigger - a slow trickle of samples still gets published.  Also
+ * where we work through the journal after an outage.
+ */
+void TelemetryBatcher::yield()
+{
+        if (sample_count > 0 and
+            millis() - first_sample_time > TELEMETRY_MAX_AGE
+        ) {
+                flush();
+        }
+        _replay_backlog();
+}
+
+
+/*
+ * Publish the current batch as a single message on the telemetry topic -
+ * or journal it if we're offline or still catching up.  Either way the
+ * batch is empty afterwards.
+ */
+void TelemetryBatcher::flush()
+{
+        if (sample_count == 0) {
+                return;
+        }
+
+        if (!lambdaHelper.AWSConnected() or journal.pending() > 0) {
+                _journal_batch();
+                return;
+        }
+
+        ScratchScope scope;
+        size_t payload_len = mqtt_payload_room(telemetry_topic) + 1;
+        char* payload = scratch.alloc<char>(payload_len);
+        if (payload == NULL) {
+                // No room to pack it now - the replay will send it later.
+                _journal_batch();
+                return;
+        }
+
+        uint8_t sent = 0;
+        while (sent < sample_count) {
+                uint8_t packed = _pack_batch(
+                        samples + sent,
+                        sample_count - sent,
+                        payload,
+                        payload_len
+                );
+                if (packed == 0) {
+                        LOG_ERROR(
+                                LOG_WEATHER,
+                                "Telemetry topic too long, dropped %u samples",
+                                sample_count - sent
+                        );
+                        break;
+                }
+                lambdaHelper.publish_to_topic(
+                        telemetry_topic,
+                        payload,
+                        OUTBOUND_TELEMETRY
+                );
+                sent += packed;
+        }
+
+        sample_count = 0;
+}
+
+
+/* Move the batch to the journal, or count it lost if that's full */
+void TelemetryBatcher::_journal_batch()
+{
+        if (!journal.append(samples, sample_count)) {
+                LOG_ERROR(
+                        LOG_WEATHER,
+                        "Journal full, dropped %u samples",
+                        sample_count
+                );
+        }
+        sample_count = 0;
+}
+
+
+/*
+ * Send one catch-up message from the journal if we're connected, the
+ * pacing interval has passed and no telemetry is waiting in the queue.
+ * We time the whole catch-up, from first replayed message to empty.
+ */
+void TelemetryBatcher::_replay_backlog()
+{
+        if (!lambdaHelper.AWSConnected() or
+            millis() - last_replay < TELEMETRY_BACKLOG_INTERVAL or
+            lambdaHelper.outbound_depth(OUTBOUND_TELEMETRY) > 0 or
+            journal.pending() == 0
+        ) {
+                return;
+        }
+
+        ScratchScope scope;
+        TelemetrySample* batch = scratch.alloc<TelemetrySample>(
+                TELEMETRY_BACKLOG_BATCH
+        );
+        size_t payload_len = mqtt_payload_room(telemetry_topic) + 1;
+        char* payload = scratch.alloc<char>(payload_len);
+        if (batch == NULL or payload == NULL) {
+                return;
+        }
+
+        uint8_t count = journal.peek(batch, TELEMETRY_BACKLOG_BATCH);
+        if (count == 0) {
+                return;
+        }
+        if (replay_samples == 0) {
+                replay_started = millis();
+        }
+
+        // Whatever didn't fit stays in the journal for the next message.
+        uint8_t packed = _pack_batch(batch, count, payload, payload_len);
+        if (packed == 0 or !lambdaHelper.publish_to_topic(
+                telemetry_topic,
+                payload,
+                OUTBOUND_TELEMETRY
+        )) {
+                return;
+        }
+
+        journal.consume(packed);
+        last_replay = millis();
+        replay_samples += packed;
+
+        if (journal.pending() == 0) {
+                recovery.recoveries++;
+                recovery.last_samples = replay_samples;
+                recovery.last_duration = millis() - replay_started;
+                replay_samples = 0;
+
+                LOG_INFO(
+                        LOG_WEATHER,
+                        "Backlog of %u samples sent in %u ms",
+                        recovery.last_samples,
+                        recovery.last_duration
+                );
+        }
+}
+
+
+/*
+ * Serialize as many samples from the front of a batch as fit in buffer_len
+ * (NUL included) and return how many that was.  Times are deltas from the
+ * first sample so every entry is a short run of integers.  The result is
+ * always complete JSON; if not even one sample fits we return 0.
+ */
+uint8_t TelemetryBatcher::_pack_batch(
+        const TelemetrySample* batch,
+        const uint8_t& count,
+        char* buffer,
+        const size_t& buffer_len
+)
+{
+        int32_t t0 = batch[0].epoch;
+        int len = snprintf_P(
+                buffer,
+                buffer_len,
+                PSTR("{\"t0\":%d,\"d\":["),
+                (int)t0
+        );
+        if (len < 0 or (size_t)len >= buffer_len) {
+                return 0;
+        }
+        size_t used = len;
+
+        // Each sample has to leave room for the closing ']}' and the NUL.
+        uint8_t packed = 0;
+        for (; packed < count; ++packed) {
+                const TelemetrySample& sample = batch[packed];
+                len = snprintf_P(
+                        buffer + used,
+                        buffer_len - used,
+                        PSTR("%s[%d,%d,%u,%u]"),
+                        packed == 0 ? "" : ",",
+                        (int)(sample.epoch - t0),
+                        (int)sample.temperature_c100,
+                        (unsigned)sample.humidity_c100,
+                        (unsigned)sample.pressure_d10
+                );
+                if (len < 0 or used + len + 3 > buffer_len) {
+                        break;
+                }
+                used += len;
+        }
+        if (packed == 0) {
+                return 0;
+        }
+
+        snprintf_P(buffer + used, buffer_len - used, PSTR("]}"));
+        return packed;
+}
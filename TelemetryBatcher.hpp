@@ -0,0 +1,115 @@
+#pragma once
+
+#include "TwilioLambdaHelper.hpp"
+#include "ObservationJournal.hpp"
+
+extern const int maxMQTTpackageSize;
+
+/* Telemetry Batching Definitions */
+// Publish once this many observations are buffered...
+#define TELEMETRY_BATCH_SIZE            8
+// ...or once the oldest buffered observation is this old (30 minutes)
+#define TELEMETRY_MAX_AGE               (30*60*1000)
+// Most samples per message when catching up on the journal - fewer go if
+// they don't fit in a packet
+#define TELEMETRY_BACKLOG_BATCH         16
+// Least time between catch-up messages, so a backlog can't hog the link
+#define TELEMETRY_BACKLOG_INTERVAL      500
+
+
+/* How we caught up after the last outage */
+struct BacklogStats {
+        /* Outages we've caught up from */
+        uint32_t        recoveries;
+
+        /* Samples and milliseconds for the last catch-up */
+        uint32_t        last_samples;
+        uint32_t        last_duration;
+};
+
+
+/*
+ * The TelemetryBatcher buffers weather observations and publishes them as
+ * one packed message on the telemetry topic.  Paying the MQTT, WebSocket and
+ * TLS framing once per batch instead of once per sample is a large saving
+ * on a board this small.
+ *
+ * Batches are sent when TELEMETRY_BATCH_SIZE samples are waiting or when
+ * the oldest sample is older than TELEMETRY_MAX_AGE, whichever comes first.
+ *
+ * The packed format is:
+ *      {"t0":<epoch>,"d":[[<dt>,<c*100>,<rh*100>,<hpa*10>],...]}
+ * where 'dt' is seconds since 't0'.  A batch that doesn't fit in one
+ * packet (with our topic) goes out as several messages.
+ *
+ * While we're offline, full batches go to an ObservationJournal on flash
+ * instead of the outbound queue.  Once we're back, yield() replays the
+ * journal in TELEMETRY_BACKLOG_BATCH sized messages, one per
+ * TELEMETRY_BACKLOG_INTERVAL, and only while the queue has no telemetry
+ * waiting.  New batches keep going to the journal until it's empty, so the
+ * history arrives in order.
+ */
+class TelemetryBatcher {
+public:
+        TelemetryBatcher(
+                const char* telemetry_topic_in,
+                TwilioLambdaHelper& lambdaHelperIn
+        );
+
+        /* Buffer an observation, publishing if the batch is full */
+        void add_observation(
+                const int32_t& epoch,
+                const float& temperature,
+                const float& humidity,
+                const float& pressure
+        );
+
+        /* Publish if the oldest buffered sample has aged out */
+        void yield();
+
+        /* Publish whatever is buffered right now */
+        void flush();
+
+        /* Buffered sample count */
+        uint8_t pending() const { return sample_count; }
+
+        /* Mount the journal - from setup(), before the heap is sealed */
+        bool begin() { return journal.begin(); }
+
+        /* Samples waiting in the journal */
+        uint16_t backlog() const { return journal.pending(); }
+
+        const JournalStats& journal_stats() const { return journal.stats(); }
+        const BacklogStats& backlog_stats() const { return recovery; }
+
+private:
+        void _journal_batch();
+        void _replay_backlog();
+        static uint8_t _pack_batch(
+                const TelemetrySample* batch,
+                const uint8_t& count,
+                char* buffer,
+                const size_t& buffer_len
+        );
+
+        TwilioLambdaHelper&             lambdaHelper;
+
+        /* History store for while we're offline */
+        ObservationJournal              journal;
+
+        /* Catch-up pacing and measurement */
+        uint32_t                        last_replay;
+        uint32_t                        replay_started;
+        uint32_t                        replay_samples;
+        BacklogStats                    recovery;
+
+        /* Where batches go */
+        const char*                     telemetry_topic;
+
+        /* Buffered samples, oldest first */
+        TelemetrySample                 samples[TELEMETRY_BATCH_SIZE];
+        uint8_t                         sample_count;
+
+        /* millis() when the oldest buffered sample was added */
+        uint32_t                        first_sample_time;
+};
@@ -0,0 +1,112 @@
+#include "TlsSessionCache.hpp"
+
+#include <coredecls.h>
+
+/* TlsSessionCache constructor - nothing cached yet. */
+TlsSessionCache::TlsSessionCache()
+        : offered_id_len(0)
+{
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/* Restore the session kept in RTC memory across deep sleep */
+void TlsSessionCache::begin()
+{
+        RtcImage image;
+        if (!ESP.rtcUserMemoryRead(
+                TLS_SESSION_RTC_OFFSET,
+                (uint32_t*)&image,
+                sizeof(image)
+        )) {
+                return;
+        }
+
+        if (image.magic != TLS_SESSION_RTC_MAGIC or
+            image.crc != crc32(
+                    &image.magic,
+                    sizeof(image) - sizeof(image.crc)
+            )
+        ) {
+                return;
+        }
+        memcpy(session.getSession(), &image.params, sizeof(image.params));
+}
+
+
+/* Hand the session to the client and remember what we offered */
+void TlsSessionCache::apply(BearSSL::WiFiClientSecure& tls_client)
+{
+        br_ssl_session_parameters* params = session.getSession();
+        offered_id_len = params->session_id_len;
+        memcpy(offered_id, params->session_id, offered_id_len);
+        tls_client.setSession(&session);
+}
+
+
+/*
+ * BearSSL writes the negotiated session back into our Session object.  If
+ * the server accepted the ID we offered it comes back unchanged.
+ */
+void TlsSessionCache::handshake_done(const uint32_t& handshake_ms)
+{
+        br_ssl_session_parameters* params = session.getSession();
+        bool resumed = offered_id_len > 0 and
+                       params->session_id_len == offered_id_len and
+                       memcmp(params->session_id, offered_id,
+                              offered_id_len) == 0;
+
+        if (resumed) {
+                counters.resumed_count++;
+                counters.resumed_total += handshake_ms;
+                if (handshake_ms > counters.resumed_max) {
+                        counters.resumed_max = handshake_ms;
+                }
+        } else {
+                counters.full_count++;
+                counters.full_total += handshake_ms;
+                if (handshake_ms > counters.full_max) {
+                        counters.full_max = handshake_ms;
+                }
+                if (params->session_id_len > 0) {
+                        _save_rtc();
+                }
+        }
+        offered_id_len = 0;
+}
+
+
+/* Drop the cached session in RAM and RTC memory */
+void TlsSessionCache::clear()
+{
+        memset(session.getSession(), 0, sizeof(br_ssl_session_parameters));
+        offered_id_len = 0;
+        _save_rtc();
+}
+
+
+/* A session ID of length zero means 'nothing to resume' */
+bool TlsSessionCache::has_session() const
+{
+        return const_cast<BearSSL::Session&>(session).getSession()
+                ->session_id_len > 0;
+}
+
+
+/* Mirror the session into RTC memory for the next wake */
+void TlsSessionCache::_save_rtc()
+{
+        RtcImage image;
+        image.magic = TLS_SESSION_RTC_MAGIC;
+        memcpy(&image.params, session.getSession(), sizeof(image.params));
+        image.crc = crc32(
+                &image.magic,
+                sizeof(image) - sizeof(image.crc)
+        );
+        ESP.rtcUserMemoryWrite(
+                TLS_SESSION_RTC_OFFSET,
+                (uint32_t*)&image,
+                sizeof(image)
+        );
+}
+
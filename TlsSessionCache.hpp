@@ -0,0 +1,75 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecureBearSSL.h>
+
+/* TLS Session Cache Definitions */
+// Where in RTC user memory (in 4 byte blocks) we keep the session
+#define TLS_SESSION_RTC_OFFSET          0
+#define TLS_SESSION_RTC_MAGIC           0x544c5331
+
+
+/* Handshake timings, split by whether the session was resumed */
+struct HandshakeStats {
+        uint32_t        full_count;
+        uint32_t        full_total;
+        uint32_t        full_max;
+        uint32_t        resumed_count;
+        uint32_t        resumed_total;
+        uint32_t        resumed_max;
+};
+
+
+/*
+ * The TlsSessionCache keeps the last TLS session we negotiated, so a
+ * reconnect after a WiFi blip can resume it and skip the RSA/ECDHE math of
+ * a full handshake - seconds of CPU on an ESP8266.
+ *
+ * The session lives in RAM and is mirrored into RTC user memory, which
+ * survives deep sleep (but not a power cycle).  A CRC guards the RTC copy.
+ *
+ * Only a transport that owns its WiFiClientSecure can use the cache.  The
+ * WebSocket library creates its TLS client internally, so over WebSockets
+ * every handshake is a full one - the timings still give us a baseline.
+ */
+class TlsSessionCache {
+public:
+        TlsSessionCache();
+
+        /* Pull a session saved before deep sleep, if there is one */
+        void begin();
+
+        /* Offer the cached session on the next connect */
+        void apply(BearSSL::WiFiClientSecure& tls_client);
+
+        /*
+         * After a connect - note whether we resumed, store the (possibly
+         * new) session and record how long the handshake took.
+         */
+        void handshake_done(const uint32_t& handshake_ms);
+
+        /* Forget the session, e.g. after the server rejected it */
+        void clear();
+
+        /* Do we have something to offer? */
+        bool has_session() const;
+
+        const HandshakeStats& stats() const { return counters; }
+
+private:
+        struct RtcImage {
+                uint32_t                        crc;
+                uint32_t                        magic;
+                br_ssl_session_parameters       params;
+        };
+
+        void _save_rtc();
+
+        BearSSL::Session                session;
+
+        /* Session ID we offered on the last connect */
+        uint8_t                         offered_id[32];
+        uint8_t                         offered_id_len;
+
+        HandshakeStats                  counters;
+};
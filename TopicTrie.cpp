@@ -0,0 +1,84 @@
+#include "TopicTrie.hpp"
+
+/* TopicTrie constructor - the node table is ours to read, not to copy. */
+TopicTrie::TopicTrie(const TopicNode* nodes_in)
+        : nodes(nodes_in)
+{
+}
+
+
+/* Route a Paho message to its handler */
+bool TopicTrie::dispatch(MQTT::MessageData& md) const
+{
+        MQTTString& topic = md.topicName;
+        TopicHandler handler;
+        if (topic.cstring != NULL) {
+                handler = match(topic.cstring, strlen(topic.cstring));
+        } else {
+                handler = match(topic.lenstring.data, topic.lenstring.len);
+        }
+
+        if (handler == NULL) {
+                return false;
+        }
+        handler(md);
+        return true;
+}
+
+
+/* Walk the trie one topic level at a time */
+TopicHandler TopicTrie::match(const char* topic, const size_t& len) const
+{
+        int8_t first = 0;
+        int8_t node = -1;
+        size_t start = 0;
+
+        while (start <= len) {
+                size_t end = start;
+                while (end < len and topic[end] != '/') {
+                        ++end;
+                }
+
+                node = _find_child(first, topic + start, end - start);
+                if (node < 0) {
+                        return NULL;
+                }
+                if (strcmp(nodes[node].level, "#") == 0) {
+                        return nodes[node].handler;
+                }
+
+                start = end + 1;
+                first = nodes[node].child;
+                if (start <= len and first < 0) {
+                        return NULL;
+                }
+        }
+        // Out of levels - "a/#" matches "a" too, as in MQTT.
+        return topic_route_end(nodes, node);
+}
+
+
+/* Among 'first' and its siblings, find the one matching this level */
+int8_t TopicTrie::_find_child(
+        const int8_t& first,
+        const char* level,
+        const size_t& level_len
+) const
+{
+        int8_t plus = -1;
+        int8_t hash = -1;
+        for (int8_t i = first; i >= 0; i = nodes[i].sibling) {
+                const char* name = nodes[i].level;
+                if (strncmp(name, level, level_len) == 0 and
+                    name[level_len] == '\0'
+                ) {
+                        return i;
+                }
+                if (strcmp(name, "+") == 0) {
+                        plus = i;
+                } else if (strcmp(name, "#") == 0) {
+                        hash = i;
+                }
+        }
+        return plus >= 0 ? plus : hash;
+}
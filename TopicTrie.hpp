@@ -0,0 +1,195 @@
+#pragma once
+
+#include <MQTTClient.h>
+
+/* Signature of a per-topic message handler */
+typedef void (*TopicHandler)(MQTT::MessageData&);
+
+
+/*
+ * One level of a topic filter.  A TopicTrie is a constant array of these,
+ * laid out by hand: 'child' is the index of the first node one level down,
+ * 'sibling' the next node on the same level, -1 for none.
+ *
+ * A level of "+" matches any single level and "#" matches everything below
+ * it - and, as in MQTT filters, the level above: "logs/#" takes "logs"
+ * too, unless "logs" has a handler of its own.  'handler' is NULL for
+ * levels that only lead somewhere else.
+ */
+struct TopicNode {
+        const char*     level;
+        int8_t          child;
+        int8_t          sibling;
+        TopicHandler    handler;
+};
+
+
+/*
+ * The TopicTrie routes an incoming message to its handler by walking the
+ * topic one level at a time, so dispatch costs time proportional to the
+ * topic's length rather than to the number of handlers.  With it we can
+ * hold a single wildcard subscription per namespace and still give each
+ * topic its own handler.
+ *
+ * Exact levels win over "+", which wins over "#".  We don't backtrack: once
+ * a level has matched we stay on that branch.
+ */
+class TopicTrie {
+public:
+        TopicTrie(const TopicNode* nodes_in);
+
+        /* Call the handler for this message's topic.  False if none. */
+        bool dispatch(MQTT::MessageData& md) const;
+
+        /* Handler for a topic of 'len' bytes, or NULL */
+        TopicHandler match(const char* topic, const size_t& len) const;
+
+private:
+        int8_t _find_child(
+                const int8_t& first,
+                const char* level,
+                const size_t& level_len
+        ) const;
+
+        const TopicNode*                nodes;
+};
+
+
+/*
+ * Compile time twins of TopicTrie::match(), for checking a constexpr route
+ * table with static_assert:
+ *
+ *      static_assert(topic_route(routes, topic) == handler, "...");
+ *
+ * They follow the same rules as match() on a NUL terminated topic.  C++11
+ * constexpr functions are a single return, hence the recursion.
+ */
+
+/* Index of the '/' or NUL ending the level that starts at i */
+constexpr size_t topic_level_end(const char* topic, const size_t i)
+{
+        return topic[i] == '\0' or topic[i] == '/' ?
+                i : topic_level_end(topic, i + 1);
+}
+
+/* Is name exactly topic[i, end)? */
+constexpr bool topic_level_is(
+        const char* name,
+        const char* topic,
+        const size_t i,
+        const size_t end
+)
+{
+        return i == end ?
+                name[0] == '\0' :
+                name[0] == topic[i] and
+                topic_level_is(name + 1, topic, i + 1, end);
+}
+
+/* Exact match for topic[start, end) among node and its siblings, or -1 */
+constexpr int8_t topic_find_exact(
+        const TopicNode* nodes,
+        const int8_t node,
+        const char* topic,
+        const size_t start,
+        const size_t end
+)
+{
+        return node < 0 ? -1 :
+                topic_level_is(nodes[node].level, topic, start, end) ? node :
+                topic_find_exact(nodes, nodes[node].sibling, topic, start, end);
+}
+
+/* The "+" or "#" (wildcard) among node and its siblings, or -1 */
+constexpr int8_t topic_find_wildcard(
+        const TopicNode* nodes,
+        const int8_t node,
+        const char wildcard
+)
+{
+        return node < 0 ? -1 :
+                nodes[node].level[0] == wildcard and
+                nodes[node].level[1] == '\0' ? node :
+                topic_find_wildcard(nodes, nodes[node].sibling, wildcard);
+}
+
+/* TopicTrie::_find_child() - exact, then "+", then "#" */
+constexpr int8_t topic_find_child(
+        const TopicNode* nodes,
+        const int8_t first,
+        const char* topic,
+        const size_t start,
+        const size_t end
+)
+{
+        return topic_find_exact(nodes, first, topic, start, end) >= 0 ?
+                topic_find_exact(nodes, first, topic, start, end) :
+                topic_find_wildcard(nodes, first, '+') >= 0 ?
+                topic_find_wildcard(nodes, first, '+') :
+                topic_find_wildcard(nodes, first, '#');
+}
+
+constexpr TopicHandler topic_route_from(
+        const TopicNode* nodes,
+        const int8_t first,
+        const char* topic,
+        const size_t start
+);
+
+/* The topic ended at node - its handler, else a "#" child's */
+constexpr TopicHandler topic_route_end(
+        const TopicNode* nodes,
+        const int8_t node
+)
+{
+        return nodes[node].handler != NULL or nodes[node].child < 0 ?
+                nodes[node].handler :
+                topic_find_wildcard(nodes, nodes[node].child, '#') < 0 ?
+                (TopicHandler)NULL :
+                nodes[topic_find_wildcard(nodes, nodes[node].child, '#')]
+                        .handler;
+}
+
+/* One step of match(): node matched the level ending at end */
+constexpr TopicHandler topic_route_at(
+        const TopicNode* nodes,
+        const int8_t node,
+        const char* topic,
+        const size_t end
+)
+{
+        return node < 0 ? (TopicHandler)NULL :
+                nodes[node].level[0] == '#' and
+                nodes[node].level[1] == '\0' ? nodes[node].handler :
+                topic[end] == '\0' ? topic_route_end(nodes, node) :
+                nodes[node].child < 0 ? (TopicHandler)NULL :
+                topic_route_from(nodes, nodes[node].child, topic, end + 1);
+}
+
+/* Route the rest of the topic, from the level at start */
+constexpr TopicHandler topic_route_from(
+        const TopicNode* nodes,
+        const int8_t first,
+        const char* topic,
+        const size_t start
+)
+{
+        return topic_route_at(
+                nodes,
+                topic_find_child(
+                        nodes,
+                        first,
+                        topic,
+                        start,
+                        topic_level_end(topic, start)
+                ),
+                topic,
+                topic_level_end(topic, start)
+        );
+}
+
+/* What TopicTrie(nodes).match(topic, strlen(topic)) would return */
+constexpr TopicHandler topic_route(const TopicNode* nodes, const char* topic)
+{
+        return topic_route_from(nodes, 0, topic, 0);
+}
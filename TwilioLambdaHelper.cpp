@@ -1,544 +1,583 @@
-#include "TwilioWeatherStation.hpp"
-
-/* TwilioWeatherStation constructor.
- *  
- * Start the NTP service, initialize the sensors, set up our own
- * preferences, and make the first weather observation.
- * 
- * It's also possible you can get the first alarm after setting it.
- */
-TwilioWeatherStation::TwilioWeatherStation(
-        const char* ntp_server,
-        const int32_t& dht_pin,
-        const int32_t& dht_type,
-        const int32_t& time_zone_offset_in,
-        const int32_t& altitude_in,
-        const int32_t& next_alarm_in,
-        const char* master_device_number_in,
-        const char* twilio_device_number_in,
-        const char* unit_type_in,
-        const char* twilio_topic_in,
-        const char* shadow_topic_in,
-        TwilioLambdaHelper& lambdaHelperIn
-)
-        : lambdaHelper(lambdaHelperIn)
-        , ntpUDP()
-        , timeClient(
-                ntpUDP, 
-                ntp_server, 
-                time_zone_offset_in*60, 
-                UPDATE_NTP_INTERVAL
-        )
-        , dht(dht_pin, dht_type)
-        , bmp(ADAFRUIT_BMP_CONSTANT)
-        , time_zone_offset(time_zone_offset_in)
-        , location_altitude(altitude_in)
-        , master_number(master_device_number_in)
-        , twilio_device_number(twilio_device_number_in)
-        , unit_type(unit_type_in)
-        , last_weather_check(0)
-        , shadow_topic(shadow_topic_in)
-        , twilio_topic(twilio_topic_in)
+#include "TwilioLambdaHelper.hpp"
 
+TwilioLambdaHelper* TwilioLambdaHelper::instance = NULL;
+
+/* TwilioLambdaHelper constructor.
+ *
+ * We only wire up the transport here - the actual connection is made in
+ * connectAWS(), once WiFi is up.
+ */
+TwilioLambdaHelper::TwilioLambdaHelper(MqttTransport& transport_in)
+        : transport(transport_in)
+        , ipstack(transport_in)
+        , client(NULL)
+        , outbound()
+        , router(NULL)
+        , subscription_count(0)
+        , connection_state(CONNECTION_BACKOFF)
+        , connect_failures(0)
+        , next_connect_attempt(0)
+        , connect_callback(NULL)
+        , session_present(false)
+        , received_this_pass(0)
+        , receive_limit(RECEIVE_UNLIMITED)
+        , first_publish_time(0)
+        , metrics()
 {
-        last_observation.temperature = 0;
-        last_observation.humidity = 0;
-        last_observation.pressure = 0;
-        last_observation.day = 0;
-        last_observation.hour = 0;
-        last_observation.minute = 0;
-        last_observation.second = 0;
-        last_observation.epoch = 0;
-
-
-        
-        dht.begin();
-        if(!bmp.begin()){
-                lambdaHelper.print_to_serial(
-                        "Check your I2C Wiring, we can't access"
-                        "the Barometric Pressure Sensor."
-                        );
-                delay(1000);
-        }
-        _display_bmp_sensor_details();
-
-        // Start NTP time sync
-        timeClient.begin();
-        timeClient.update();
-
-        // First weather check
-        last_weather_check = millis();
-
-        // Bootstrap the alarm
-        next_alarm.timestamp = 0;
-        next_alarm.rang = true;
-        TwilioWeatherStation::update_alarm(next_alarm_in);
-
-        // Make first weather observation (which may ring the alarm)
-        make_observation(last_observation);
-        print_observation(last_observation);
+        memset(&receive, 0, sizeof(receive));
+        memset(&session, 0, sizeof(session));
+        instance = this;
 }
 
 
-/* Heartbeat function for Weather Station - update NTP, make observation */
-void TwilioWeatherStation::yield()
+/* Connect (or reconnect) to AWS IoT over our transport */
+bool TwilioLambdaHelper::connectAWS()
 {
-        // This likes to be polled 
-        timeClient.update();
-        
-        if (millis() > last_weather_check + RECHECK_WEATHER_INTERVAL) { 
-                lambdaHelper.print_to_serial("BEFORE Remaining Heap Size: ");
-                lambdaHelper.print_to_serial(ESP.getFreeHeap());
-                lambdaHelper.print_to_serial("\r\n");
-                last_weather_check = millis();
-                
-                make_observation(last_observation);
-                print_observation(last_observation);
-
-                lambdaHelper.print_to_serial("AFTER Remaining Heap Size: ");
-                lambdaHelper.print_to_serial(ESP.getFreeHeap());
-                lambdaHelper.print_to_serial("\r\n");
+        // Start from a fresh Paho client each time
+        if (client != NULL) {
+                if (client->isConnected()) {
+                        client->disconnect();
+                }
+                client->~MqttClient();
+        }
+        client = new (client_storage) MqttClient(ipstack);
+
+        uint32_t handshake_start = millis();
+        int rc = ipstack.connect(transport.host(), transport.port());
+        uint32_t handshake_time = millis() - handshake_start;
+        if (rc != 1) {
+                metrics.record_failure(CONNECT_FAILED_TRANSPORT);
+                LOG_WARN(LOG_NET, "Error connecting over %s", transport.name());
+                return false;
+        }
+        LOG_INFO(LOG_NET, "%s layer connected", transport.name());
+
+        // Persistent session - the broker keeps our subscriptions (keyed
+        // on the client ID) while we are disconnected.
+        MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
+        data.MQTTVersion = 4;
+        data.cleansession = 0;
+        char client_id[24];
+        _generate_client_id(client_id, sizeof(client_id));
+        data.clientID.cstring = client_id;
+
+        MQTT::connackData connack;
+        rc = client->connect(data, connack);
+        if (rc != 0) {
+                metrics.record_failure(CONNECT_FAILED_MQTT);
+                LOG_WARN(LOG_MQTT, "Error connecting to MQTT: %d", rc);
+                return false;
+        }
+
+        session.connects++;
+        metrics.record_connected(handshake_time);
+        session_present = connack.sessionPresent;
+        if (session_present) {
+                session.sessions_resumed++;
+        } else {
+                // A fresh session holds none of our subscriptions.
+                for (uint8_t i = 0; i < subscription_count; ++i) {
+                        subscriptions[i].acknowledged = false;
+                }
         }
+
+        LOG_INFO(
+                LOG_MQTT,
+                "MQTT connected, session %s",
+                session_present ? "resumed" : "new"
+        );
+        return true;
 }
 
 
-/* Read from the sensors and update our current conditions */
-void TwilioWeatherStation::make_observation(WObservation& obs) 
+/* Are both the transport and MQTT layers up? */
+bool TwilioLambdaHelper::AWSConnected()
 {
-        // Read from BMP Sensor
-        sensors_event_t event;
-        bmp.getEvent(&event);
-
-        float dht_humidity = dht.readHumidity();
-        float dht_temperature = dht.readTemperature();
-
-        // Read from DHT Sensor
-        if (event.pressure and 
-            !(isnan(dht_humidity) or 
-                    isnan(dht_temperature))
-        ) {                     
-                float bmp_temperature;
-                bmp.getTemperature(&bmp_temperature);
-                float avg_temperature = (dht_temperature + bmp_temperature)/2;
-
-                obs.temperature = avg_temperature;
-                obs.humidity = dht_humidity;
-                obs.pressure = event.pressure;
-
-                obs.day = timeClient.getDay();
-                obs.hour = timeClient.getHours();
-                obs.minute = timeClient.getMinutes();
-                obs.second = timeClient.getSeconds();
-                obs.epoch = timeClient.getEpochTime();
-
-                // Check if we just passed an unrung alarm, but only in the 
-                // last 2 weather samples.
-                if (!next_alarm.rang) {
-                        if (obs.epoch > next_alarm.timestamp and
-                            next_alarm.timestamp + \
-                            (RECHECK_WEATHER_INTERVAL/1000)*2 > obs.epoch
-                        ) {
-                                lambdaHelper.print_to_serial(
-                                        "We just hit an alarm!\r\n"
-                                );
-                                _handle_alarm();
-                        }
+        return client != NULL and
+               transport.connected() and
+               client->isConnected();
+}
+
+
+/*
+ * Reconnect state machine.  While we're up this is just a status check.
+ * Once we drop, each call is cheap until the backoff elapses, then we make
+ * one (blocking) connection attempt and either report back up or back off
+ * further.
+ */
+bool TwilioLambdaHelper::maintain_connection()
+{
+        if (connection_state == CONNECTION_UP) {
+                if (AWSConnected()) {
+                        return true;
                 }
+                LOG_WARN(LOG_NET, "Lost connection to AWS IoT");
+                metrics.record_disconnected();
+                connection_state = CONNECTION_BACKOFF;
+                connect_failures = 0;
+                _schedule_reconnect();
+                return false;
+        }
 
-        } else {
-                lambdaHelper.print_to_serial(
-                        "Sensor errors!  Please check your board."
-                );
-                lambdaHelper.print_to_serial("\r\n");
-                return;
+        if ((int32_t)(millis() - next_connect_attempt) < 0) {
+                return false;
+        }
+
+        // No point in a TLS handshake without WiFi - check back later.
+        uint32_t start = millis();
+        metrics.record_attempt();
+        if (WiFi.status() != WL_CONNECTED) {
+                metrics.record_failure(CONNECT_FAILED_WIFI);
+        }
+        if (WiFi.status() != WL_CONNECTED or !connectAWS()) {
+                if (connect_failures < 255) {
+                        connect_failures++;
+                }
+                _schedule_reconnect();
+                return false;
+        }
+
+        connection_state = CONNECTION_UP;
+        connect_failures = 0;
+        if (connect_callback != NULL) {
+                connect_callback(session_present);
+        }
+
+        // Time to ready covers the handshake and whatever the callback
+        // needed to (re)subscribe.
+        session.last_time_to_ready = millis() - start;
+        if (session.last_time_to_ready > session.max_time_to_ready) {
+                session.max_time_to_ready = session.last_time_to_ready;
         }
+        return true;
 }
 
 
-/* Dump a lot of weather information to serial (if it exists) */
-void TwilioWeatherStation::print_observation(const WObservation& obs) {
-        lambdaHelper.print_to_serial("Time is currently: ");
-        lambdaHelper.print_to_serial(timeClient.getFormattedTime());
-        lambdaHelper.print_to_serial("(");
-        lambdaHelper.print_to_serial(obs.epoch);
-        lambdaHelper.print_to_serial(")\r\n");
-        lambdaHelper.print_to_serial("Timestamp: ");
-        lambdaHelper.print_to_serial(obs.day); 
-        lambdaHelper.print_to_serial(" ");
-        lambdaHelper.print_to_serial(obs.hour); 
-        lambdaHelper.print_to_serial(":");
-        lambdaHelper.print_to_serial(obs.minute); 
-        lambdaHelper.print_to_serial(":");
-        lambdaHelper.print_to_serial(obs.second);
-        lambdaHelper.print_to_serial(" Pressure: "); 
-        lambdaHelper.print_to_serial(obs.pressure); 
-        lambdaHelper.print_to_serial(" hPa at sea level, ");
-        lambdaHelper.print_to_serial(
-                _hpa_to_in_mercury(
-                        _hpa_to_sea_level(
-                                obs.temperature,
-                                obs.pressure,
-                                location_altitude
-                        )
-                )
-        ); 
-        lambdaHelper.print_to_serial(" inhg at sea level, ");
-        lambdaHelper.print_to_serial("Temperature: "); 
-        lambdaHelper.print_to_serial(obs.temperature); 
-        lambdaHelper.print_to_serial(" *C, "); 
-        lambdaHelper.print_to_serial(
-                _celsius_to_fahrenheit(obs.temperature)
-        ); 
-        lambdaHelper.print_to_serial(" *F, ");
-        lambdaHelper.print_to_serial("Humidity: "); 
-        lambdaHelper.print_to_serial(obs.humidity); 
-        lambdaHelper.print_to_serial(" %");
-        lambdaHelper.print_to_serial("\r\n");
+/* Run this after every successful connect */
+void TwilioLambdaHelper::set_connect_callback(void (*callback)(bool))
+{
+        connect_callback = callback;
 }
 
 
-/* The NTP library reports days as an integer, with '0' representing Sunday. */
-const char* TwilioWeatherStation::int_to_day(int int_day)
+/* Milliseconds until the next reconnect attempt, 0 if connected */
+uint32_t TwilioLambdaHelper::reconnect_delay() const
 {
-        const char* int_to_day[] = {
-                "Sun.", "Mon.", "Tue.", "Wed.", "Thu.", "Fri.", "Sat."
-        };
-        return int_to_day[int_day];
+        if (connection_state == CONNECTION_UP or
+            (int32_t)(millis() - next_connect_attempt) >= 0
+        ) {
+                return 0;
+        }
+        return next_connect_attempt - millis();
 }
 
-/* 
- *  Report current setup, possibly after a power cycle.  We may get
- *  a delta in response
-*/
-void TwilioWeatherStation::report_shadow_state(const char* topic) 
+
+/*
+ * Heartbeat - let Paho read messages, then catch up on the queue.
+ *
+ * We yield to Paho in short slices and stop once a slice comes back empty
+ * (nothing waiting) or the message or time budget is spent.  Unread
+ * messages wait in the socket until next time.
+ *
+ * One slice can hold several messages, so the message budget is enforced
+ * per message: _dispatch() pauses the transport's input as soon as the
+ * budget is used up, and Paho stops reading after that packet.
+ */
+void TwilioLambdaHelper::handleRequests(const uint8_t& max_messages)
 {
-        StaticJsonBuffer<maxMQTTpackageSize> jsonBuffer;
-        JsonObject& root = jsonBuffer.createObject();
-        JsonObject& state = root.createNestedObject("state");
-        JsonObject& reported = state.createNestedObject("reported");
-
-        reported["alarm"] = next_alarm.timestamp;
-        reported["units"] = unit_type;
-        reported["alt"] = location_altitude;
-        reported["tz"] = time_zone_offset;
-        reported["t_num"] = twilio_device_number.c_str();
-        reported["m_num"] = master_number.c_str();
-        
-        std::unique_ptr<char []> buffer(new char[maxMQTTpackageSize]());
-        root.printTo(buffer.get(), maxMQTTpackageSize);
-        lambdaHelper.print_to_serial(buffer.get()); 
-        lambdaHelper.publish_to_topic(topic, buffer.get());
+        if (client == NULL) {
+                return;
+        }
+
+        PROFILE_SCOPE(PROFILE_HANDLE_REQUESTS);
+
+        uint32_t start = millis();
+        received_this_pass = 0;
+        receive_limit = max_messages;
+        transport.pause_input(false);
+        while (received_this_pass < max_messages) {
+                uint8_t before = received_this_pass;
+                client->yield(RECEIVE_SLICE);
+                if (received_this_pass == before or
+                    millis() - start >= RECEIVE_BUDGET or
+                    !AWSConnected()
+                ) {
+                        break;
+                }
+        }
+
+        // Outside a pass - in subscribe(), say - Paho reads as it likes.
+        receive_limit = RECEIVE_UNLIMITED;
+        transport.pause_input(false);
+
+        uint32_t elapsed = millis() - start;
+        receive.passes++;
+        receive.messages += received_this_pass;
+        receive.time_in_receive += elapsed;
+        if (received_this_pass >= max_messages or elapsed >= RECEIVE_BUDGET) {
+                receive.budget_exhausted++;
+        }
+        if (received_this_pass > receive.max_messages_per_pass) {
+                receive.max_messages_per_pass = received_this_pass;
+        }
+        if (elapsed > receive.max_time_per_pass) {
+                receive.max_time_per_pass = elapsed;
+        }
+
+        _drain_outbound();
 }
 
 
-/* Set a desired shadow state */
-void TwilioWeatherStation::update_shadow_state(
-        const String& topic,
-        const int32_t& new_alarm,
-        const String& new_units,
-        const int32_t& new_alt,
-        const int32_t& new_tz,
-        const String& new_tnum,
-        const String& new_mnum
-)
+/* Every message we receive is dispatched through this trie */
+void TwilioLambdaHelper::set_topic_router(const TopicTrie& router_in)
 {
-        StaticJsonBuffer<maxMQTTpackageSize> jsonBuffer;
-        JsonObject& root = jsonBuffer.createObject();
-        JsonObject& state = root.createNestedObject("state");
-        JsonObject& reported = state.createNestedObject("desired");
-
-        reported["alarm"] = new_alarm;
-        reported["units"] = new_units.c_str();
-        reported["alt"] = new_alt;
-        reported["tz"] = new_tz;
-        reported["t_num"] = new_tnum.c_str();
-        reported["m_num"] = new_mnum.c_str();
-        
-        std::unique_ptr<char []> buffer(new char[maxMQTTpackageSize]());
-        root.printTo(buffer.get(), maxMQTTpackageSize);
-        lambdaHelper.print_to_serial(buffer.get()); 
-        lambdaHelper.publish_to_topic(topic.c_str(), buffer.get());
+        router = &router_in;
 }
 
 
-/* When we receive a new shadow update, update all of our preferences */
-void TwilioWeatherStation::update_alarm(const int32_t& alarm_in) 
+/* Subscribe to a topic filter; the router sorts out who handles what */
+bool TwilioLambdaHelper::subscribe_to_topic(const char* topic)
 {
+        if (client == NULL) {
+                return false;
+        }
 
-        if (next_alarm.timestamp == alarm_in) {
-                // Don't reset it, forget it.
-                return;
-        } 
+        // Remember the filter - resubscribing after a reconnect just
+        // finds the existing entry.
+        uint8_t i = 0;
+        while (i < subscription_count and
+               strcmp(subscriptions[i].topic, topic) != 0
+        ) {
+                ++i;
+        }
+        if (i == maxMQTTMessageHandlers) {
+                LOG_ERROR(LOG_MQTT, "No free handler for: %s", topic);
+                return false;
+        }
+        subscriptions[i].topic = topic;
+        if (i == subscription_count) {
+                subscriptions[i].acknowledged = false;
+                subscription_count++;
+        }
 
-        /* Check alarm validity */
-        if (last_observation.epoch > alarm_in or alarm_in == 0) {
-                // This is in the past or turns alarms off.
-                next_alarm.rang = true;
-        } else {
-                // New, future alarm
-                next_alarm.rang = false;
+        // The broker still has it - just point this Paho client at us.
+        if (session_present and subscriptions[i].acknowledged) {
+                client->setMessageHandler(topic, _dispatch);
+                session.subscribes_skipped++;
+                return true;
         }
 
-        next_alarm.timestamp = alarm_in;
-        lambdaHelper.print_to_serial("Alarm updated to: "); 
-        lambdaHelper.print_to_serial(next_alarm.timestamp); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        int rc = client->subscribe(topic, MQTT::QOS0, _dispatch);
+        if (rc != 0) {
+                LOG_WARN(
+                        LOG_MQTT,
+                        "Error subscribing to: %s rc: %d",
+                        topic,
+                        rc
+                );
+                return false;
+        }
+        subscriptions[i].acknowledged = true;
+        session.subscribes_sent++;
+        LOG_INFO(LOG_MQTT, "Subscribed to: %s", topic);
+        return true;
 }
 
 
-/* Change between metric and imperial units */
-void TwilioWeatherStation::update_units(String units_in) 
+/*
+ * Publish a message, or queue it if we can't right now.  We only skip the
+ * queue when nothing of the same or higher priority is already waiting, so
+ * messages in a class never overtake each other.
+ */
+bool TwilioLambdaHelper::publish_to_topic(
+        const char* topic,
+        const char* payload,
+        const OutboundPriority& priority
+)
 {
-        if (units_in.equals("imperial") or units_in.equals("metric")) {
-                unit_type = units_in;
-                lambdaHelper.print_to_serial("Units updated to: "); 
-                lambdaHelper.print_to_serial(unit_type); 
-                lambdaHelper.print_to_serial("\r\n"); 
-        } else {
-                lambdaHelper.print_to_serial(
-                        "Unit type must be 'imperial' or 'metric'\r\n"
-                        ); 
+        if (outbound.depth_at_or_above(priority) == 0 and AWSConnected()) {
+                uint32_t start = millis();
+                if (_publish_now(topic, payload)) {
+                        outbound.record_direct(priority, millis() - start);
+                        return true;
+                }
+        }
+
+        if (!outbound.push(priority, topic, payload)) {
+                LOG_ERROR(
+                        LOG_MQTT,
+                        "Outbound queue full, dropped message to: %s",
+                        topic
+                );
+                return false;
         }
-        
+        return true;
 }
 
 
-/* Change station altitude */
-void TwilioWeatherStation::update_alt(const int32_t& alt_in)
+/* Package an SMS or MMS for the Lambda function to send through Twilio */
+bool TwilioLambdaHelper::send_twilio_message(
+        const char* topic,
+        const char* to_number,
+        const char* from_number,
+        const char* message_body,
+        const char* picture_url,
+        const OutboundPriority& priority
+)
 {
-        location_altitude = alt_in;
-        lambdaHelper.print_to_serial("Altitude updated to: "); 
-        lambdaHelper.print_to_serial(location_altitude); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        ScratchScope scope;
+        ScratchJsonBuffer jsonBuffer;
+        JsonObject& root = jsonBuffer.createObject();
+        root["To"] = to_number;
+        root["From"] = from_number;
+        root["Body"] = message_body;
+        root["Type"] = "Outgoing";
+        if (picture_url[0] != '\0') {
+                root["Image"] = picture_url;
+        }
+
+        char* payload = scratch.alloc<char>(maxMQTTpackageSize);
+        if (payload == NULL) {
+                return false;
+        }
+        root.printTo(payload, maxMQTTpackageSize);
+        return publish_to_topic(topic, payload, priority);
 }
 
 
-/* Update Timezone */
-void TwilioWeatherStation::update_tz(const int32_t& tz_in)
+/* Package one SMS body for several recipients */
+bool TwilioLambdaHelper::send_twilio_broadcast(
+        const char* topic,
+        const char* const* to_numbers,
+        const uint8_t& to_count,
+        const char* from_number,
+        const char* message_body,
+        const OutboundPriority& priority
+)
 {
-        time_zone_offset = tz_in;
-        lambdaHelper.print_to_serial("Timezone offset set to: "); 
-        lambdaHelper.print_to_serial(time_zone_offset); 
-        lambdaHelper.print_to_serial("\r\n"); 
-        timeClient.setTimeOffset(time_zone_offset*60);
-        timeClient.forceUpdate();
+        ScratchScope scope;
+        ScratchJsonBuffer jsonBuffer;
+        JsonObject& root = jsonBuffer.createObject();
+        JsonArray& to = root.createNestedArray("To");
+        for (uint8_t i = 0; i < to_count; ++i) {
+                to.add(to_numbers[i]);
+        }
+        root["From"] = from_number;
+        root["Body"] = message_body;
+        root["Type"] = "Outgoing";
+
+        char* payload = scratch.alloc<char>(maxMQTTpackageSize);
+        if (payload == NULL) {
+                return false;
+        }
+        root.printTo(payload, maxMQTTpackageSize);
+        return publish_to_topic(topic, payload, priority);
 }
 
 
-/* Update Twilio Number of Device */
-void TwilioWeatherStation::update_tnum(String tnum_in)
+/* Dump the MQTT details of a message to serial */
+void TwilioLambdaHelper::list_message_info(const MQTT::Message& message)
 {
-        twilio_device_number = tnum_in;
-        lambdaHelper.print_to_serial("Device number updated to: "); 
-        lambdaHelper.print_to_serial(twilio_device_number); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        LOG_DEBUG(
+                LOG_MQTT,
+                "Message arrived: qos %d, retained %d, dup %d, packetid %d",
+                (int)message.qos,
+                (int)message.retained,
+                (int)message.dup,
+                (int)message.id
+        );
 }
 
 
-/* Update Master Number for Alarm */
-void TwilioWeatherStation::update_mnum(String mnum_in)
+/* Outbound queue counters */
+const OutboundStats& TwilioLambdaHelper::outbound_stats() const
 {
-        master_number = mnum_in;
-        lambdaHelper.print_to_serial("Master number updated to: "); 
-        lambdaHelper.print_to_serial(master_number); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        return outbound.stats();
 }
 
 
-/* Craft a nice string containing the current conditions */
-String TwilioWeatherStation::get_weather_report(String intro)
+/* Messages waiting to go out */
+uint8_t TwilioLambdaHelper::outbound_depth() const
 {
-        // Max size of 160 characters plus termination
-        std::unique_ptr<char []> return_body(new char[161]());
-
-        // ESP8266 doesn't support float format strings
-        // so we need to convert everything manually.
-        std::unique_ptr<char []> temperature(new char[9]());
-        std::unique_ptr<char []> humidity(new char[9]());
-        std::unique_ptr<char []> pressure(new char[9]());
-        std::unique_ptr<char []> pressure_conv(new char[9]());
-
-        float slvl_press = _hpa_to_sea_level(
-                last_observation.humidity,
-                last_observation.pressure,
-                location_altitude
-                );
+        return outbound.depth();
+}
 
-        // Convert to fixed length strings
-        dtostrf(last_observation.humidity, 8, 2, humidity.get());
-        dtostrf(slvl_press, 8, 2, pressure.get());
-
-        String f_or_c = "C";
-        String in_or_mm = "mm";
-        
-        if (unit_type.equals("imperial")) {
-                dtostrf(
-                        _celsius_to_fahrenheit(last_observation.temperature), 
-                        8, 
-                        2, 
-                        temperature.get()
-                        );
-                dtostrf(
-                        _hpa_to_in_mercury(slvl_press), 
-                        8, 
-                        2, 
-                        pressure_conv.get()
-                        );
-                f_or_c = "F";
-                in_or_mm = "in";
-        } else {
-                dtostrf(last_observation.temperature, 8, 2, temperature.get());
-                dtostrf(
-                        _in_to_mm(_hpa_to_in_mercury(slvl_press)), 
-                        8, 
-                        2, 
-                        pressure_conv.get()
-                        );
-        }
-
-        snprintf(
-                return_body.get(),
-                160,
-                "%sConditions as of %s %i:%i:%i\n%s *%s\n%s " \
-                "% Humidity\n%s hPc (%s %s Hg)\n",
-                intro.c_str(),
-                TwilioWeatherStation::int_to_day(last_observation.day),
-                last_observation.hour,
-                last_observation.minute,
-                last_observation.second,
-                temperature.get(),
-                f_or_c.c_str(),
-                humidity.get(),
-                pressure.get(),
-                pressure_conv.get(),
-                in_or_mm.c_str()
-                );
 
-        return String(return_body.get());
+/* Messages of one class waiting to go out */
+uint8_t TwilioLambdaHelper::outbound_depth(
+        const OutboundPriority& priority
+) const
+{
+        return outbound.depth(priority);
 }
 
 
-/* Dump details of the BMP Sensor */
-void TwilioWeatherStation::_display_bmp_sensor_details()
+/* Milliseconds the oldest waiting message has been queued */
+uint32_t TwilioLambdaHelper::outbound_oldest_age() const
 {
-      sensor_t sensor;
-      bmp.getSensor(&sensor);
-      lambdaHelper.print_to_serial("------------------------------------\r\n");
-      lambdaHelper.print_to_serial("BMP Sensor:       "); 
-      lambdaHelper.print_to_serial(sensor.name);
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Driver Ver:   "); 
-      lambdaHelper.print_to_serial(sensor.version);
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Unique ID:    "); 
-      lambdaHelper.print_to_serial(sensor.sensor_id);
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Max Value:    "); 
-      lambdaHelper.print_to_serial(sensor.max_value); 
-      lambdaHelper.print_to_serial(" hPa");
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Min Value:    "); 
-      lambdaHelper.print_to_serial(sensor.min_value); 
-      lambdaHelper.print_to_serial(" hPa");
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Resolution:   "); 
-      lambdaHelper.print_to_serial(sensor.resolution); 
-      lambdaHelper.print_to_serial(" hPa");
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("------------------------------------\r\n");
-      delay(500);
+        return outbound.oldest_age();
 }
 
 
 /*
- * Function to convert celsius to fahrenheit
+ * Publish the connection metrics block - it is bulk, so low priority.  The
+ * block leaves room for the extra members, which replace its closing '}'.
  */
-inline float TwilioWeatherStation::_celsius_to_fahrenheit(
-        const float& celsius
-)
+bool TwilioLambdaHelper::publish_metrics(const char* topic, const char* extra)
 {
-        return (float)(round((celsius*9/5*1000) + 32000)) / 1000;
+        // The whole object has to fit in one packet with the topic.
+        size_t payload_len = mqtt_payload_room(topic) + 1;
+        size_t extra_len = extra != NULL ? strlen(extra) + 1 : 0;
+        if (extra_len >= payload_len) {
+                return false;
+        }
+
+        ScratchScope scope;
+        char* payload = scratch.alloc<char>(payload_len);
+        if (payload == NULL) {
+                return false;
+        }
+        size_t room = payload_len - extra_len;
+        size_t used = metrics.to_json(payload, room);
+        if (used == 0 or used >= room) {
+                return false;
+        }
+        if (extra_len > 0) {
+                // '...}' becomes '...,<extra>}'
+                payload[used - 1] = ',';
+                memcpy(payload + used, extra, extra_len - 1);
+                payload[used + extra_len - 1] = '}';
+                payload[used + extra_len] = '\0';
+        }
+        return publish_to_topic(topic, payload, OUTBOUND_TELEMETRY);
 }
 
 
-/*
- * Function to convert hectopascals to inches of mercury
- */
-inline float TwilioWeatherStation::_hpa_to_in_mercury(const float& hpa)
+/* Count an incoming message and route it by topic */
+void TwilioLambdaHelper::_dispatch(MQTT::MessageData& md)
 {
-        return (float)(round(HPA_TO_IN_MERCURY * hpa * 1000)) / 1000;
-}   
+        TwilioLambdaHelper* self = instance;
+        self->received_this_pass++;
+        if (self->received_this_pass >= self->receive_limit) {
+                self->transport.pause_input(true);
+        }
 
+        MQTTString& topic = md.topicName;
+        if (topic.cstring != NULL) {
+                self->metrics.record_in(
+                        topic.cstring,
+                        strlen(topic.cstring),
+                        md.message.payloadlen
+                );
+        } else {
+                self->metrics.record_in(
+                        topic.lenstring.data,
+                        topic.lenstring.len,
+                        md.message.payloadlen
+                );
+        }
 
-/*
- * Function to convert hectopascals to inches of mercury
- */
-inline float TwilioWeatherStation::_in_to_mm(const float& inches)
-{
-        return (float)(round(25.4 * inches * 1000)) / 1000;
+        if (self->router != NULL) {
+                self->router->dispatch(md);
+        }
 }
 
 
 /*
- * Function to convert HPA at our station to HPA at Sea Level
- * 
- * This should be reasonably accurate for most elevations, but for higher 
- * altitudes there is generally a table lookup.  For the United States, that 
- * table would come from the U.S Standard Atmosphere: 
- * https://ccmc.gsfc.nasa.gov/modelweb/atmos/us_standard.html
+ * Pick the next reconnect time - capped exponential backoff with "equal
+ * jitter": half the backoff is fixed, the other half random.  The jitter
+ * comes from the hardware RNG so every station gets a different sequence.
  */
-float TwilioWeatherStation::_hpa_to_sea_level(
-    const float& celsius, 
-    const float& hpa, 
-    const int& altitude
-)
+void TwilioLambdaHelper::_schedule_reconnect()
 {
-        // Convert celsius to kelvin
-        float kelvin = 273.1 + celsius;
-
-        // Technically, scale height should be the average atmospheric 
-        // temperature, but we don't have enough measurements to make a 
-        // more accurate guess at the atmospheric temperature.
-        float scale_height = 
-         (ATM_JOULES_PER_KILOGRAM_KELVIN * kelvin) /    \
-                GRAVITATIONAL_ACCELERATION;
+        uint32_t backoff = RECONNECT_BACKOFF_BASE;
+        for (uint8_t i = 0; i < connect_failures and
+             backoff < RECONNECT_BACKOFF_MAX; ++i) {
+                backoff *= 2;
+        }
+        if (backoff > RECONNECT_BACKOFF_MAX) {
+                backoff = RECONNECT_BACKOFF_MAX;
+        }
 
-        // Observed pressure * exp( altitude / scale_height )
-        float adjusted_pressure = \
-                hpa * \
-                (float)pow(E_CONSTANT, (location_altitude/scale_height));
+        uint32_t delay_ms = backoff / 2 + RANDOM_REG32 % (backoff / 2 + 1);
+        next_connect_attempt = millis() + delay_ms;
 
-        return (float)(round(adjusted_pressure * 1000)) / 1000;    
- }
+        LOG_INFO(LOG_NET, "Next AWS connection attempt in %u ms", delay_ms);
+}
 
 
-/* Handle passing the alarm epoch time */
-void TwilioWeatherStation::_handle_alarm() 
+/* Hand a message straight to Paho */
+bool TwilioLambdaHelper::_publish_now(const char* topic, const char* payload)
 {
-        // Attempt to set the alarm one day out
-        update_shadow_state(
-                shadow_topic,
-                next_alarm.timestamp + 86400,
-                unit_type,
-                location_altitude,
-                time_zone_offset,
-                twilio_device_number,
-                master_number
+        MQTT::Message message;
+        message.qos = MQTT::QOS0;
+        message.retained = false;
+        message.dup = false;
+        message.payload = (void*)payload;
+        message.payloadlen = strlen(payload) + 1;
+
+        uint32_t start = millis();
+        int rc = client->publish(topic, message);
+        if (rc != 0) {
+                LOG_WARN(LOG_MQTT, "Error publishing to: %s rc: %d", topic, rc);
+                return false;
+        }
+
+        metrics.record_out(topic, message.payloadlen, millis() - start);
+
+        // Boot (or wake) to first publish - what fast connects buy us.
+        if (first_publish_time == 0) {
+                first_publish_time = millis();
+                LOG_INFO(
+                        LOG_SYSTEM,
+                        "First publish %u ms after boot",
+                        first_publish_time
                 );
+        }
+        return true;
+}
 
-        // Alarm rang
-        next_alarm.rang = true;
 
-        // Text the master number the current conditions
-        String weather_string = get_weather_report("Daily Report!\n");
+/*
+ * Send whatever is due from the outbound queue.  Each round walks the
+ * classes most urgent first, letting each send up to its burst quota, and
+ * we keep going until a round sends nothing.  We stop at the first failure
+ * and let the backoff decide when to try again.
+ */
+void TwilioLambdaHelper::_drain_outbound()
+{
+        outbound.expire();
+
+        bool sent_any = true;
+        while (sent_any and AWSConnected()) {
+                sent_any = false;
+                for (uint8_t c = 0; c < OUTBOUND_CLASSES; ++c) {
+                        OutboundPriority priority = (OutboundPriority)c;
+                        uint8_t burst = OutboundQueue::burst(priority);
+                        for (uint8_t i = 0; i < burst; ++i) {
+                                OutboundMessage* msg = outbound.due(priority);
+                                if (msg == NULL) {
+                                        break;
+                                }
+
+                                if (!_publish_now(msg->topic, msg->payload)) {
+                                        outbound.defer(priority);
+                                        return;
+                                }
+                                outbound.pop(priority);
+                                sent_any = true;
+                        }
+                }
+        }
+}
 
-        // Send a weather update from the device number to the master number
-        lambdaHelper.send_twilio_message(
-                twilio_topic.c_str(),
-                master_number,
-                twilio_device_number, 
-                weather_string,
-                String("")
-        );
-       
-}
\ No newline at end of file
+
+/*
+ * MQTT client ID, fixed per chip so the broker can find our persistent
+ * session again.  AWS IoT drops the older connection if two clients share
+ * an ID, so it has to be unique across the fleet too.
+ */
+void TwilioLambdaHelper::_generate_client_id(char* client_id, const size_t& len)
+{
+        snprintf_P(client_id, len, PSTR("tws-%08x"), (unsigned)ESP.getChipId());
+}
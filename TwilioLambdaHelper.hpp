@@ -1,168 +1,303 @@
 #pragma once
 
-#include "TwilioLambdaHelper.hpp"
-
-// Normally we'd wrap the Helper and it's actually not required to declare 
-// these externs, but to see where they come from and to see what changed from 
-// the previous guide we'll leave these declarations.
-extern const int maxMQTTpackageSize;
-extern const int maxMQTTMessageHandlers;
-
-#include <Adafruit_BMP085_U.h>
-#include <DHT.h>
-#include <DHT_U.h>
-#include <NTPClient.h>
-#include <WiFiUdp.h>
-
-/* Weather and Constant Definitions */
-#define HPA_TO_IN_MERCURY               .0295299830714
-#define SEA_LEVEL_PRESSURE_HPA          1013.25
-#define GRAVITATIONAL_ACCELERATION      9.807
-#define ATM_JOULES_PER_KILOGRAM_KELVIN  287.1
-#define E_CONSTANT                      2.718281828182
-#define ADAFRUIT_BMP_CONSTANT           10180
-
-// X minutes at 60000 ticks per minute
-#define UPDATE_NTP_INTERVAL             10*60*1000
-// Every 3 minutes
-#define RECHECK_WEATHER_INTERVAL        3*60*1000 
-
-/* 
- *  Weather observation struct.  Not sure if you would like to expand
- *  this, so it is separate from the TWS class.
- *  
- *  (4 bytes * 3) + 1 + 1 + 1 + 1 + 8 = 24 Bytes each as it is.
- *  On my board there are ~ 17-18 KiB free 
+#include <ESP8266WiFi.h>
+#include <new>
+
+// Embedded Paho MQTT Client
+#include <MQTTClient.h>
+#include <IPStack.h>
+#include <Countdown.h>
+
+// Handle incoming messages
+#include <ArduinoJson.h>
+
+#include "Log.hpp"
+#include "Profiler.hpp"
+
+/*
+ * MQTT limits - bump these if you need larger messages or more
+ * subscriptions.  Each subscription is a whole namespace routed through a
+ * TopicTrie, so we need very few.
  */
-struct WObservation {
-        /* Temperature in Celsius */
-        float           temperature;
+const int maxMQTTpackageSize = 512;
+const int maxMQTTMessageHandlers = 3;
 
-        /* Humidity Percentage */
-        float           humidity;
+// A QoS 0 PUBLISH is a fixed header byte, the remaining length (two bytes
+// below 16 KiB), the topic length, the topic and the payload - all of it
+// has to fit in maxMQTTpackageSize.
+#define MQTT_PUBLISH_HEADER_LEN         5
+static_assert(
+        maxMQTTpackageSize < 16384,
+        "MQTT_PUBLISH_HEADER_LEN assumes a two byte remaining length"
+);
 
-        /* Pressure in hPA, adjusted to Sea Level  */
-        float           pressure;
+/*
+ * Longest payload string we can publish to topic.  We send the NUL too,
+ * so that comes off as well.  0 if even the topic doesn't fit.
+ */
+inline size_t mqtt_payload_room(const char* topic)
+{
+        size_t overhead = MQTT_PUBLISH_HEADER_LEN + strlen(topic) + 1;
+        return overhead < maxMQTTpackageSize ?
+                maxMQTTpackageSize - overhead : 0;
+}
 
-        /* Timestamp fields - 4 bytes total */
-        uint8_t         day;
-        uint8_t         hour;
-        uint8_t         minute;
-        uint8_t         second;
+// E.164 is at most 15 digits plus the '+'
+#define E164_MAX_LEN                    16
 
-        /* 
-         * Epoch time (for comparisons) 
-         * Match the UNIX type, even though we'll rollover in 2038
-         */
-        int32_t        epoch;       
+#include "OutboundQueue.hpp"
+#include "TopicTrie.hpp"
+#include "MqttTransport.hpp"
+#include "ConnectionMetrics.hpp"
+#include "ScratchArena.hpp"
+
+/* Receive Budget Definitions */
+// Most messages handleRequests() reads per call...
+#define RECEIVE_MAX_MESSAGES            4
+// ...and most time it spends reading, in milliseconds
+#define RECEIVE_BUDGET                  50
+// Paho yield() slice - we check the budget between slices
+#define RECEIVE_SLICE                   10
+// No message cap, outside handleRequests()
+#define RECEIVE_UNLIMITED               255
+
+
+/* Reconnect Definitions */
+// First reconnect after ~2 seconds, doubling up to 5 minutes
+#define RECONNECT_BACKOFF_BASE          2000
+#define RECONNECT_BACKOFF_MAX           (5*60*1000)
+
+
+/* Connection states for maintain_connection() */
+enum ConnectionState {
+        CONNECTION_UP = 0,
+        CONNECTION_BACKOFF
 };
 
 
+/* Counters for MQTT sessions - they only go up (except the timings) */
+struct SessionStats {
+        uint32_t        connects;
+        uint32_t        sessions_resumed;
+        uint32_t        subscribes_sent;
+        uint32_t        subscribes_skipped;
+        uint32_t        last_time_to_ready;
+        uint32_t        max_time_to_ready;
+};
+
+
+/* Counters for the receive path - they only go up (except the maxima) */
+struct ReceiveStats {
+        uint32_t        passes;
+        uint32_t        messages;
+        uint32_t        budget_exhausted;
+        uint32_t        time_in_receive;
+        uint16_t        max_messages_per_pass;
+        uint16_t        max_time_per_pass;
+};
+
 
 /*
- * The TwilioWeatherStation class simplifies the handling of some of the 
- * necessary functions for reporting the weather.
- * 
- * We're encapsulating timekeeping, polling the sensors and updating the 
- * preferences to keep the .ino file relatively uncluttered.  
+ * The TwilioLambdaHelper wraps the connection to AWS IoT and the Twilio
+ * message format we post to the Lambda function on the other side.  The
+ * bytes go over an MqttTransport - WebSockets signed with SigV4, or MQTT
+ * straight over TLS with a client certificate.
+ *
+ * Publishes never get lost to a dropped connection: anything we can't send
+ * right now waits in an OutboundQueue and is retried once we are connected
+ * again.  Every publish carries an OutboundPriority so an alert never waits
+ * behind a telemetry backlog.
+ *
+ * Receiving is time sliced: each handleRequests() reads at most a budget of
+ * messages or milliseconds, and anything past that stays in the socket for
+ * the next call.  That keeps a burst of inbound texts from starving the
+ * sensors and NTP.
+ *
+ * Reconnecting is driven by maintain_connection() from loop().  After a
+ * drop it waits an exponentially growing, randomly jittered delay between
+ * attempts, so the sketch keeps sampling while we're offline and a fleet
+ * of stations doesn't hammer the endpoint in lockstep after an outage.
+ *
+ * We connect with a persistent session (clean-session=false) and a client
+ * ID fixed to the chip, so the broker keeps our subscriptions while we're
+ * away.  When the CONNACK says the session is still there, subscribing
+ * again only re-registers the callback locally - no SUBSCRIBE goes out.
+ *
+ * Incoming messages are routed by a TopicTrie rather than by Paho's
+ * handler table, so one wildcard subscription can feed many handlers.
  */
-class TwilioWeatherStation {
+class TwilioLambdaHelper {
 public:
-        TwilioWeatherStation(
-                const char* ntp_server,
-                const int& dht_pin,
-                const int& dht_type,
-                const int32_t& time_zone_offset_in,
-                const int& altitude_in,
-                const int32_t& next_alarm_in,
-                const char* master_device_number_in,
-                const char* twilio_device_number_in,
-                const char* unit_type_in,
-                const char* twilio_topic_in,
-                const char* shadow_topic_in,
-                TwilioLambdaHelper& lambdaHelperIn
+        TwilioLambdaHelper(MqttTransport& transport_in);
+
+        /* Connection management */
+        bool connectAWS();
+        bool AWSConnected();
+
+        /*
+         * Call every loop().  Returns true if we're connected, otherwise
+         * makes a connection attempt only if the backoff has elapsed.
+         */
+        bool maintain_connection();
+
+        /*
+         * Called after every successful (re)connect - resubscribe here.  The
+         * argument is true if the broker resumed our previous session.
+         */
+        void set_connect_callback(void (*callback)(bool));
+
+        /* Did the broker still have our session on the last connect? */
+        bool session_resumed() const { return session_present; }
+
+        /*
+         * Service the MQTT client and the outbound queue, reading at most
+         * max_messages messages or RECEIVE_BUDGET milliseconds.
+         */
+        void handleRequests(const uint8_t& max_messages=RECEIVE_MAX_MESSAGES);
+
+        /* Route every incoming message through this trie */
+        void set_topic_router(const TopicTrie& router_in);
+
+        /*
+         * Subscribe to a topic filter - wildcards welcome.  Messages go to
+         * the topic router.  The filter must outlive the helper - we keep
+         * the pointer to resubscribe.
+         */
+        bool subscribe_to_topic(const char* topic_filter);
+
+        /*
+         * Publish to a topic.  Returns false only if the message had to be
+         * dropped; a message that is queued for later counts as accepted.
+         */
+        bool publish_to_topic(
+                const char* topic,
+                const char* payload,
+                const OutboundPriority& priority
         );
 
-        /* Heartbeat function - every loop we need to do maintenance in here */
-        void yield();
-
-        /* Return contents of last sensor check. */
-        String get_weather_report(String intro="");
-
-        /* Check the sensors and print the latest check */
-        void make_observation(WObservation& obs);
-        void print_observation(const WObservation& obs);
-
-        /* Getters and Setters */
-        void update_alarm(const int32_t& alarm_in);
-        void update_units(String units_in);
-        void update_alt(const int32_t& alt_in);
-        void update_tz(const int32_t& tz_in);
-        void update_tnum(String tnum_in);
-        void update_mnum(String mnum_in);
-
-        /* Report current shadow state (and possibly get a delta) */
-        void report_shadow_state(const char* topic);
-
-        /* Set a desired shadow state, new alarms, etc. */
-        void update_shadow_state(
-                const String& topic,
-                const int32_t& new_alarm,
-                const String& new_units,
-                const int32_t& new_alt,
-                const int32_t& new_tz,
-                const String& new_tnum,
-                const String& new_mnum
+        /* Build an 'Outgoing' message for our Lambda function to send */
+        bool send_twilio_message(
+                const char* topic,
+                const char* to_number,
+                const char* from_number,
+                const char* message_body,
+                const char* picture_url="",
+                const OutboundPriority& priority=OUTBOUND_REPLY
         );
 
-        /* Int to day string mapping */
-        static const char* int_to_day(int int_day);
-        
+        /*
+         * One 'Outgoing' message for many recipients - 'To' is a list and
+         * the Lambda function sends each of them their own SMS.
+         */
+        bool send_twilio_broadcast(
+                const char* topic,
+                const char* const* to_numbers,
+                const uint8_t& to_count,
+                const char* from_number,
+                const char* message_body,
+                const OutboundPriority& priority=OUTBOUND_REPLY
+        );
+
+        /* Log details of an incoming message */
+        void list_message_info(const MQTT::Message& message);
+
+        /* Outbound queue statistics */
+        const OutboundStats& outbound_stats() const;
+        uint8_t outbound_depth() const;
+        uint8_t outbound_depth(const OutboundPriority& priority) const;
+        uint32_t outbound_oldest_age() const;
+
+        /* Failed connects since we were last up, and ms until the next */
+        uint8_t reconnect_attempts() const { return connect_failures; }
+        uint32_t reconnect_delay() const;
+
+        /* Session statistics */
+        const SessionStats& session_stats() const { return session; }
+
+        /* Receive path statistics */
+        const ReceiveStats& receive_stats() const { return receive; }
+
+        /*
+         * Connection health counters, and a way to publish them.  extra is
+         * more members for the same object ('"rl":[..]'), added at the end.
+         */
+        const ConnectionMetrics& connection_metrics() const { return metrics; }
+        bool publish_metrics(const char* topic, const char* extra=NULL);
+
+        /* millis() of our first publish since boot, 0 if none yet */
+        uint32_t first_publish() const { return first_publish_time; }
+
+        /* Transport byte counts and TLS handshake timings */
+        const TransportStats& transport_stats() const
+        {
+                return transport.stats();
+        }
+        const HandshakeStats& handshake_stats() const
+        {
+                return transport.handshake_stats();
+        }
+
 private:
-        void _display_bmp_sensor_details();
-        void _handle_alarm();
-        float _celsius_to_fahrenheit(const float& celsius);
-        float _hpa_to_in_mercury(const float& hpa);
-        float _hpa_to_sea_level(
-            const float& celsius, 
-            const float& hpa, 
-            const int& altitude
-            );
-        float _in_to_mm(const float& inches);
-
-        /* 
-         *  We're keeping a TwilioLambdaHelper reference to 
-         *  show how the code differs from the previous guides.  In the 
-         *  embedded world we can cheat - if the reference no longer exists 
-         *  we've either got larger problems... or the power was cut.
-         *  
-         *  Don't do this on the desktop!!!
+        /* Paho calls this for every message; we count it and route it */
+        static void _dispatch(MQTT::MessageData& md);
+
+        bool _publish_now(const char* topic, const char* payload);
+        void _schedule_reconnect();
+        void _drain_outbound();
+        void _generate_client_id(char* client_id, const size_t& len);
+
+        typedef MQTT::Client<
+                IPStack,
+                Countdown,
+                maxMQTTpackageSize,
+                maxMQTTMessageHandlers
+        > MqttClient;
+
+        /*
+         * Network stack - a transport, then Paho on top.  Each connect
+         * builds a fresh client in client_storage rather than on the heap.
          */
-        TwilioLambdaHelper&             lambdaHelper;
-
-        /* Sensors and Timekeeping */
-        WiFiUDP                         ntpUDP;
-        NTPClient                       timeClient;
-        DHT                             dht;
-        Adafruit_BMP085_Unified         bmp;
-
-        /* Most recent weather observation and time */
-        WObservation                    last_observation;
-        uint64_t                        last_weather_check;
-
-        /* Next alarm */
-        struct Alarm {
-                int32_t timestamp;
-                bool rang;
-        } next_alarm;
-
-        /* Preferences */
-        int32_t location_altitude;
-        int32_t time_zone_offset;
-        String master_number;
-        String twilio_device_number;
-        String unit_type;
-        String shadow_topic;
-        String twilio_topic;
-
-};
\ No newline at end of file
+        MqttTransport&                  transport;
+        IPStack                         ipstack;
+        MqttClient*                     client;
+        alignas(MqttClient) uint8_t     client_storage[sizeof(MqttClient)];
+
+        /* Messages waiting for a connection */
+        OutboundQueue                   outbound;
+
+        /* Where incoming messages go */
+        const TopicTrie*                router;
+
+        /* Our subscriptions */
+        struct Subscription {
+                const char*     topic;
+
+                /* The broker holds this subscription in our session */
+                bool            acknowledged;
+        }                               subscriptions[maxMQTTMessageHandlers];
+        uint8_t                         subscription_count;
+
+        /* Reconnect state machine */
+        ConnectionState                 connection_state;
+        uint8_t                         connect_failures;
+        uint32_t                        next_connect_attempt;
+        void                            (*connect_callback)(bool);
+
+        /* Persistent session state */
+        bool                            session_present;
+        SessionStats                    session;
+
+        /* Messages read during the current handleRequests(), and the cap */
+        uint8_t                         received_this_pass;
+        uint8_t                         receive_limit;
+        ReceiveStats                    receive;
+
+        /* millis() when the first publish went out */
+        uint32_t                        first_publish_time;
+
+        /* Connection health, published on request */
+        ConnectionMetrics               metrics;
+
+        /* Paho callbacks have no context, so _dispatch() finds us here */
+        static TwilioLambdaHelper*      instance;
+};
@@ -1,5 +1,10 @@
 #include "TwilioWeatherStation.hpp"
 
+/* Day names, kept in flash - the last one is for a day we don't know */
+static const char day_names[DAYS_PER_WEEK + 1][DAY_NAME_LEN] PROGMEM = {
+        "Sun.", "Mon.", "Tue.", "Wed.", "Thu.", "Fri.", "Sat.", "???"
+};
+
 /* TwilioWeatherStation constructor.
  *  
  * Start the NTP service, initialize the sensors, set up our own
@@ -19,6 +24,7 @@
         const char* unit_type_in,
         const char* twilio_topic_in,
         const char* shadow_topic_in,
+        const char* telemetry_topic_in,
         TwilioLambdaHelper& lambdaHelperIn
         )
  : lambdaHelper(lambdaHelperIn)
@@ -33,12 +39,10 @@
  , bmp(ADAFRUIT_BMP_CONSTANT)
  , time_zone_offset(time_zone_offset_in)
  , location_altitude(altitude_in)
- , master_number(master_device_number_in)
- , twilio_device_number(twilio_device_number_in)
- , unit_type(unit_type_in)
  , last_weather_check(0)
  , shadow_topic(shadow_topic_in)
  , twilio_topic(twilio_topic_in)
+ , telemetry(telemetry_topic_in, lambdaHelperIn)
 
  {
         last_observation.temperature = 0;
@@ -50,18 +54,36 @@
         last_observation.second = 0;
         last_observation.epoch = 0;
 
-
+        master_number[0] = '\0';
+        twilio_device_number[0] = '\0';
+        _copy_number(master_number, master_device_number_in, "Master");
+        _copy_number(
+                twilio_device_number,
+                twilio_device_number_in,
+                "Device"
+        );
+        strncpy(unit_type, unit_type_in, UNIT_TYPE_LEN - 1);
+        unit_type[UNIT_TYPE_LEN - 1] = '\0';
         
         dht.begin();
         if(!bmp.begin()){
-                lambdaHelper.print_to_serial(
-                        "Check your I2C Wiring, we can't access"
+                LOG_ERROR(
+                        LOG_WEATHER,
+                        "Check your I2C Wiring, we can't access "
                         "the Barometric Pressure Sensor."
-                        );
+                );
                 delay(1000);
         }
         _display_bmp_sensor_details();
 
+        // Load any telemetry journaled before a reset
+        if (!telemetry.begin()) {
+                LOG_ERROR(
+                        LOG_WEATHER,
+                        "Can't mount SPIFFS, telemetry won't be kept offline"
+                );
+        }
+
         // Start NTP time sync
         timeClient.begin();
         timeClient.update();
@@ -83,21 +105,21 @@
 /* Heartbeat function for Weather Station - update NTP, make observation */
 void TwilioWeatherStation::yield()
 {
-        // This likes to be polled 
-        timeClient.update();
+        // This likes to be polled - its UDP packets are lwIP allocations
+        {
+                PROFILE_SCOPE(PROFILE_NTP_UPDATE);
+                HeapSealExemption packet_allocations;
+                timeClient.update();
+        }
+
+        // Publish a partial telemetry batch if it has waited long enough
+        telemetry.yield();
         
         if (millis() > last_weather_check + RECHECK_WEATHER_INTERVAL) { 
-                lambdaHelper.print_to_serial("BEFORE Remaining Heap Size: ");
-                lambdaHelper.print_to_serial(ESP.getFreeHeap());
-                lambdaHelper.print_to_serial("\r\n");
                 last_weather_check = millis();
                 
                 make_observation(last_observation);
                 print_observation(last_observation);
-
-                lambdaHelper.print_to_serial("AFTER Remaining Heap Size: ");
-                lambdaHelper.print_to_serial(ESP.getFreeHeap());
-                lambdaHelper.print_to_serial("\r\n");
         }
 }
 
@@ -105,6 +127,8 @@ void TwilioWeatherStation::yield()
 /* Read from the sensors and update our current conditions */
 void TwilioWeatherStation::make_observation(WObservation& obs) 
 {
+        PROFILE_SCOPE(PROFILE_MAKE_OBSERVATION);
+
         // Read from BMP Sensor
         sensors_event_t event;
         bmp.getEvent(&event);
@@ -131,6 +155,14 @@ void TwilioWeatherStation::make_observation(WObservation& obs)
                 obs.second = timeClient.getSeconds();
                 obs.epoch = timeClient.getEpochTime();
 
+                // Queue the sample for the next telemetry batch
+                telemetry.add_observation(
+                        obs.epoch,
+                        obs.temperature,
+                        obs.humidity,
+                        obs.pressure
+                );
+
                 // Check if we just passed an unrung alarm, but only in the 
                 // last 2 weather samples.
                 if (!next_alarm.rang) {
@@ -138,18 +170,16 @@ void TwilioWeatherStation::make_observation(WObservation& obs)
                             next_alarm.timestamp + \
                             (RECHECK_WEATHER_INTERVAL/1000)*2 > obs.epoch
                         ) {
-                                lambdaHelper.print_to_serial(
-                                        "We just hit an alarm!\r\n"
-                                );
+                                LOG_INFO(LOG_WEATHER, "We just hit an alarm!");
                                 _handle_alarm();
                         }
                 }
 
         } else {
-                lambdaHelper.print_to_serial(
+                LOG_ERROR(
+                        LOG_WEATHER,
                         "Sensor errors!  Please check your board."
                 );
-                lambdaHelper.print_to_serial("\r\n");
                 return;
         }
 }
@@ -157,53 +187,48 @@ void TwilioWeatherStation::make_observation(WObservation& obs)
 
 /* Dump a lot of weather information to serial (if it exists) */
 void TwilioWeatherStation::print_observation(const WObservation& obs) {
-        lambdaHelper.print_to_serial("Time is currently: ");
-        lambdaHelper.print_to_serial(timeClient.getFormattedTime());
-        lambdaHelper.print_to_serial("(");
-        lambdaHelper.print_to_serial(obs.epoch);
-        lambdaHelper.print_to_serial(")\r\n");
-        lambdaHelper.print_to_serial("Timestamp: ");
-        lambdaHelper.print_to_serial(obs.day); 
-        lambdaHelper.print_to_serial(" ");
-        lambdaHelper.print_to_serial(obs.hour); 
-        lambdaHelper.print_to_serial(":");
-        lambdaHelper.print_to_serial(obs.minute); 
-        lambdaHelper.print_to_serial(":");
-        lambdaHelper.print_to_serial(obs.second);
-        lambdaHelper.print_to_serial(" Pressure: "); 
-        lambdaHelper.print_to_serial(obs.pressure); 
-        lambdaHelper.print_to_serial(" hPa at sea level, ");
-        lambdaHelper.print_to_serial(
+        LOG_DEBUG(
+                LOG_WEATHER,
+                "Time is currently: %02u:%02u:%02u(%d)",
+                obs.hour,
+                obs.minute,
+                obs.second,
+                obs.epoch
+        );
+        LOG_DEBUG(
+                LOG_WEATHER,
+                "Timestamp: %d %d:%d:%d Pressure: %.2f hPa at sea level, "
+                "%.3f inhg at sea level, Temperature: %.2f *C, %.2f *F, "
+                "Humidity: %.2f %%",
+                obs.day,
+                obs.hour,
+                obs.minute,
+                obs.second,
+                obs.pressure,
                 _hpa_to_in_mercury(
                         _hpa_to_sea_level(
                                 obs.temperature,
                                 obs.pressure,
                                 location_altitude
                         )
-                )
-        ); 
-        lambdaHelper.print_to_serial(" inhg at sea level, ");
-        lambdaHelper.print_to_serial("Temperature: "); 
-        lambdaHelper.print_to_serial(obs.temperature); 
-        lambdaHelper.print_to_serial(" *C, "); 
-        lambdaHelper.print_to_serial(
-                _celsius_to_fahrenheit(obs.temperature)
-        ); 
-        lambdaHelper.print_to_serial(" *F, ");
-        lambdaHelper.print_to_serial("Humidity: "); 
-        lambdaHelper.print_to_serial(obs.humidity); 
-        lambdaHelper.print_to_serial(" %");
-        lambdaHelper.print_to_serial("\r\n");
+                ),
+                obs.temperature,
+                _celsius_to_fahrenheit(obs.temperature),
+                obs.humidity
+        );
 }
 
 
-/* The NTP library reports days as an integer, with '0' representing Sunday. */
-const char* TwilioWeatherStation::int_to_day(int int_day)
+/*
+ * The NTP library reports days as an integer, with '0' representing Sunday.
+ * The names live in flash - copy one out with strncpy_P() before using it.
+ */
+PGM_P TwilioWeatherStation::int_to_day(int int_day)
 {
-        const char* int_to_day[] = {
-                "Sun.", "Mon.", "Tue.", "Wed.", "Thu.", "Fri.", "Sat."
-        };
-        return int_to_day[int_day];
+        if (int_day < 0 or int_day >= DAYS_PER_WEEK) {
+                return day_names[DAYS_PER_WEEK];
+        }
+        return day_names[int_day];
 }
 
 /* 
@@ -212,7 +237,11 @@ const char* TwilioWeatherStation::int_to_day(int int_day)
 */
 void TwilioWeatherStation::report_shadow_state(const char* topic) 
 {
-        StaticJsonBuffer<maxMQTTpackageSize> jsonBuffer;
+        PROFILE_SCOPE(PROFILE_REPORT_SHADOW);
+        STACK_SCOPE(STACK_REPORT_SHADOW);
+
+        ScratchScope scope;
+        ScratchJsonBuffer jsonBuffer;
         JsonObject& root = jsonBuffer.createObject();
         JsonObject& state = root.createNestedObject("state");
         JsonObject& reported = state.createNestedObject("reported");
@@ -221,43 +250,52 @@ void TwilioWeatherStation::report_shadow_state(const char* topic)
         reported["units"] = unit_type;
         reported["alt"] = location_altitude;
         reported["tz"] = time_zone_offset;
-        reported["t_num"] = twilio_device_number.c_str();
-        reported["m_num"] = master_number.c_str();
+        reported["t_num"] = twilio_device_number;
+        reported["m_num"] = master_number;
         
-        std::unique_ptr<char []> buffer(new char[maxMQTTpackageSize]());
-        root.printTo(buffer.get(), maxMQTTpackageSize);
-        lambdaHelper.print_to_serial(buffer.get()); 
-        lambdaHelper.publish_to_topic(topic, buffer.get());
+        char* payload = scratch.alloc<char>(maxMQTTpackageSize);
+        if (payload == NULL) {
+                return;
+        }
+        root.printTo(payload, maxMQTTpackageSize);
+        LOG_DEBUG(LOG_SHADOW, "%s", payload);
+        lambdaHelper.publish_to_topic(topic, payload, OUTBOUND_SHADOW);
 }
 
 
 /* Set a desired shadow state */
 void TwilioWeatherStation::update_shadow_state(
-        const String& topic,
+        const char* topic,
         const int32_t& new_alarm,
-        const String& new_units,
+        const char* new_units,
         const int32_t& new_alt,
         const int32_t& new_tz,
-        const String& new_tnum,
-        const String& new_mnum
+        const char* new_tnum,
+        const char* new_mnum
 )
 {
-        StaticJsonBuffer<maxMQTTpackageSize> jsonBuffer;
+        STACK_SCOPE(STACK_UPDATE_SHADOW);
+
+        ScratchScope scope;
+        ScratchJsonBuffer jsonBuffer;
         JsonObject& root = jsonBuffer.createObject();
         JsonObject& state = root.createNestedObject("state");
         JsonObject& reported = state.createNestedObject("desired");
 
         reported["alarm"] = new_alarm;
-        reported["units"] = new_units.c_str();
+        reported["units"] = new_units;
         reported["alt"] = new_alt;
         reported["tz"] = new_tz;
-        reported["t_num"] = new_tnum.c_str();
-        reported["m_num"] = new_mnum.c_str();
+        reported["t_num"] = new_tnum;
+        reported["m_num"] = new_mnum;
         
-        std::unique_ptr<char []> buffer(new char[maxMQTTpackageSize]());
-        root.printTo(buffer.get(), maxMQTTpackageSize);
-        lambdaHelper.print_to_serial(buffer.get()); 
-        lambdaHelper.publish_to_topic(topic.c_str(), buffer.get());
+        char* payload = scratch.alloc<char>(maxMQTTpackageSize);
+        if (payload == NULL) {
+                return;
+        }
+        root.printTo(payload, maxMQTTpackageSize);
+        LOG_DEBUG(LOG_SHADOW, "%s", payload);
+        lambdaHelper.publish_to_topic(topic, payload, OUTBOUND_ALARM);
 }
 
 
@@ -280,24 +318,24 @@ void TwilioWeatherStation::update_alarm(const int32_t& alarm_in)
         }
 
         next_alarm.timestamp = alarm_in;
-        lambdaHelper.print_to_serial("Alarm updated to: "); 
-        lambdaHelper.print_to_serial(next_alarm.timestamp); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        LOG_INFO(LOG_SHADOW, "Alarm updated to: %d", next_alarm.timestamp);
 }
 
 
 /* Change between metric and imperial units */
-void TwilioWeatherStation::update_units(String units_in) 
+void TwilioWeatherStation::update_units(const char* units_in) 
 {
-        if (units_in.equals("imperial") or units_in.equals("metric")) {
-                unit_type = units_in;
-                lambdaHelper.print_to_serial("Units updated to: "); 
-                lambdaHelper.print_to_serial(unit_type); 
-                lambdaHelper.print_to_serial("\r\n"); 
+        if (units_in != NULL and
+            (strcmp(units_in, "imperial") == 0 or
+             strcmp(units_in, "metric") == 0)
+        ) {
+                strcpy(unit_type, units_in);
+                LOG_INFO(LOG_SHADOW, "Units updated to: %s", unit_type);
         } else {
-                lambdaHelper.print_to_serial(
-                        "Unit type must be 'imperial' or 'metric'\r\n"
-                        ); 
+                LOG_WARN(
+                        LOG_SHADOW,
+                        "Unit type must be 'imperial' or 'metric'"
+                );
         }
         
 }
@@ -307,9 +345,7 @@ void TwilioWeatherStation::update_units(String units_in)
 void TwilioWeatherStation::update_alt(const int32_t& alt_in)
 {
         location_altitude = alt_in;
-        lambdaHelper.print_to_serial("Altitude updated to: "); 
-        lambdaHelper.print_to_serial(location_altitude); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        LOG_INFO(LOG_SHADOW, "Altitude updated to: %d", location_altitude);
 }
 
 
@@ -317,46 +353,58 @@ void TwilioWeatherStation::update_alt(const int32_t& alt_in)
 void TwilioWeatherStation::update_tz(const int32_t& tz_in)
 {
         time_zone_offset = tz_in;
-        lambdaHelper.print_to_serial("Timezone offset set to: "); 
-        lambdaHelper.print_to_serial(time_zone_offset); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        LOG_INFO(LOG_SHADOW, "Timezone offset set to: %d", time_zone_offset);
         timeClient.setTimeOffset(time_zone_offset*60);
+
+        // The NTP request and reply are lwIP packets - allocated
+        HeapSealExemption packet_allocations;
         timeClient.forceUpdate();
 }
 
 
 /* Update Twilio Number of Device */
-void TwilioWeatherStation::update_tnum(String tnum_in)
+void TwilioWeatherStation::update_tnum(const char* tnum_in)
 {
-        twilio_device_number = tnum_in;
-        lambdaHelper.print_to_serial("Device number updated to: "); 
-        lambdaHelper.print_to_serial(twilio_device_number); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        if (!_copy_number(twilio_device_number, tnum_in, "Device")) {
+                return;
+        }
+        LOG_INFO(
+                LOG_SHADOW,
+                "Device number updated to: %s",
+                twilio_device_number
+        );
 }
 
 
 /* Update Master Number for Alarm */
-void TwilioWeatherStation::update_mnum(String mnum_in)
+void TwilioWeatherStation::update_mnum(const char* mnum_in)
 {
-        master_number = mnum_in;
-        lambdaHelper.print_to_serial("Master number updated to: "); 
-        lambdaHelper.print_to_serial(master_number); 
-        lambdaHelper.print_to_serial("\r\n"); 
+        if (!_copy_number(master_number, mnum_in, "Master")) {
+                return;
+        }
+        LOG_INFO(
+                LOG_SHADOW,
+                "Master number updated to: %s",
+                master_number
+        );
 }
 
 
 /* Craft a nice string containing the current conditions */
-String TwilioWeatherStation::get_weather_report(String intro)
+size_t TwilioWeatherStation::get_weather_report(
+        char* buffer,
+        const size_t& buffer_len,
+        PGM_P intro
+)
 {
-        // Max size of 160 characters plus termination
-        std::unique_ptr<char []> return_body(new char[161]());
+        PROFILE_SCOPE(PROFILE_WEATHER_REPORT);
 
         // ESP8266 doesn't support float format strings
         // so we need to convert everything manually.
-        std::unique_ptr<char []> temperature(new char[9]());
-        std::unique_ptr<char []> humidity(new char[9]());
-        std::unique_ptr<char []> pressure(new char[9]());
-        std::unique_ptr<char []> pressure_conv(new char[9]());
+        char temperature[9];
+        char humidity[9];
+        char pressure[9];
+        char pressure_conv[9];
 
         float slvl_press = _hpa_to_sea_level(
                 last_observation.humidity,
@@ -365,56 +413,71 @@ String TwilioWeatherStation::get_weather_report(String intro)
                 );
 
         // Convert to fixed length strings
-        dtostrf(last_observation.humidity, 8, 2, humidity.get());
-        dtostrf(slvl_press, 8, 2, pressure.get());
+        dtostrf(last_observation.humidity, 8, 2, humidity);
+        dtostrf(slvl_press, 8, 2, pressure);
 
-        String f_or_c = "C";
-        String in_or_mm = "mm";
+        const char* f_or_c = "C";
+        const char* in_or_mm = "mm";
         
-        if (unit_type.equals("imperial")) {
+        if (strcmp(unit_type, "imperial") == 0) {
                 dtostrf(
                         _celsius_to_fahrenheit(last_observation.temperature), 
                         8, 
                         2, 
-                        temperature.get()
+                        temperature
                         );
                 dtostrf(
                         _hpa_to_in_mercury(slvl_press), 
                         8, 
                         2, 
-                        pressure_conv.get()
+                        pressure_conv
                         );
                 f_or_c = "F";
                 in_or_mm = "in";
         } else {
-                dtostrf(last_observation.temperature, 8, 2, temperature.get());
+                dtostrf(last_observation.temperature, 8, 2, temperature);
                 dtostrf(
                         _in_to_mm(_hpa_to_in_mercury(slvl_press)), 
                         8, 
                         2, 
-                        pressure_conv.get()
+                        pressure_conv
                         );
         }
 
-        snprintf(
-                return_body.get(),
-                160,
-                "%sConditions as of %s %i:%i:%i\n%s *%s\n%s " \
-                "% Humidity\n%s hPc (%s %s Hg)\n",
-                intro.c_str(),
-                TwilioWeatherStation::int_to_day(last_observation.day),
+        // The intro and the day name are in flash, and %s wants RAM.
+        size_t intro_len = 0;
+        if (intro != NULL) {
+                strncpy_P(buffer, intro, buffer_len);
+                buffer[buffer_len - 1] = '\0';
+                intro_len = strlen(buffer);
+        }
+        char day[DAY_NAME_LEN];
+        strncpy_P(day, int_to_day(last_observation.day), sizeof(day));
+        day[sizeof(day) - 1] = '\0';
+
+        int len = snprintf_P(
+                buffer + intro_len,
+                buffer_len - intro_len,
+                PSTR("Conditions as of %s %i:%i:%i\n%s *%s\n%s "
+                     "%% Humidity\n%s hPc (%s %s Hg)\n"),
+                day,
                 last_observation.hour,
                 last_observation.minute,
                 last_observation.second,
-                temperature.get(),
-                f_or_c.c_str(),
-                humidity.get(),
-                pressure.get(),
-                pressure_conv.get(),
-                in_or_mm.c_str()
+                temperature,
+                f_or_c,
+                humidity,
+                pressure,
+                pressure_conv,
+                in_or_mm
                 );
 
-        return String(return_body.get());
+        if (len < 0) {
+                buffer[0] = '\0';
+                return 0;
+        }
+        len += intro_len;
+        return (size_t)len < buffer_len ? len : buffer_len - 1;
 }
 
 
@@ -423,29 +486,14 @@ void TwilioWeatherStation::_display_bmp_sensor_details()
 {
       sensor_t sensor;
       bmp.getSensor(&sensor);
-      lambdaHelper.print_to_serial("------------------------------------\r\n");
-      lambdaHelper.print_to_serial("BMP Sensor:       "); 
-      lambdaHelper.print_to_serial(sensor.name);
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Driver Ver:   "); 
-      lambdaHelper.print_to_serial(sensor.version);
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Unique ID:    "); 
-      lambdaHelper.print_to_serial(sensor.sensor_id);
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Max Value:    "); 
-      lambdaHelper.print_to_serial(sensor.max_value); 
-      lambdaHelper.print_to_serial(" hPa");
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Min Value:    "); 
-      lambdaHelper.print_to_serial(sensor.min_value); 
-      lambdaHelper.print_to_serial(" hPa");
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("Resolution:   "); 
-      lambdaHelper.print_to_serial(sensor.resolution); 
-      lambdaHelper.print_to_serial(" hPa");
-      lambdaHelper.print_to_serial("\r\n");
-      lambdaHelper.print_to_serial("------------------------------------\r\n");
+      LOG_INFO(LOG_WEATHER, "------------------------------------");
+      LOG_INFO(LOG_WEATHER, "BMP Sensor:       %s", sensor.name);
+      LOG_INFO(LOG_WEATHER, "Driver Ver:   %d", sensor.version);
+      LOG_INFO(LOG_WEATHER, "Unique ID:    %d", sensor.sensor_id);
+      LOG_INFO(LOG_WEATHER, "Max Value:    %.2f hPa", sensor.max_value);
+      LOG_INFO(LOG_WEATHER, "Min Value:    %.2f hPa", sensor.min_value);
+      LOG_INFO(LOG_WEATHER, "Resolution:   %.2f hPa", sensor.resolution);
+      LOG_INFO(LOG_WEATHER, "------------------------------------");
       delay(500);
 }
 
@@ -512,6 +560,22 @@ float TwilioWeatherStation::_hpa_to_sea_level(
  }
 
 
+/* Copy a phone number preference, refusing one that won't fit */
+bool TwilioWeatherStation::_copy_number(
+        char* number,
+        const char* number_in,
+        const char* name
+)
+{
+        if (number_in == NULL or strlen(number_in) >= E164_MAX_LEN) {
+                LOG_WARN(LOG_SHADOW, "%s number is not E.164, ignored", name);
+                return false;
+        }
+        strcpy(number, number_in);
+        return true;
+}
+
+
 /* Handle passing the alarm epoch time */
 void TwilioWeatherStation::_handle_alarm() 
 {
@@ -530,15 +594,25 @@ void TwilioWeatherStation::_handle_alarm()
         next_alarm.rang = true;
 
         // Text the master number the current conditions
-        String weather_string = get_weather_report("Daily Report!\n");
+        ScratchScope scope;
+        char* weather_report = scratch.alloc<char>(WEATHER_REPORT_LEN);
+        if (weather_report == NULL) {
+                return;
+        }
+        get_weather_report(
+                weather_report,
+                WEATHER_REPORT_LEN,
+                PSTR("Daily Report!\n")
+        );
 
         // Send a weather update from the device number to the master number
         lambdaHelper.send_twilio_message(
-                twilio_topic.c_str(),
+                twilio_topic,
                 master_number,
                 twilio_device_number, 
-                weather_string,
-                String("")
+                weather_report,
+                "",
+                OUTBOUND_ALARM
         );
        
 }
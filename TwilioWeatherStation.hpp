@@ -1,6 +1,9 @@
 #pragma once
 
 #include "TwilioLambdaHelper.hpp"
+#include "TelemetryBatcher.hpp"
+#include "Profiler.hpp"
+#include "StackMonitor.hpp"
 
 // Normally we'd wrap the Helper and it's actually not required to declare 
 // these externs, but to see where they come from and to see what changed from 
@@ -26,6 +29,13 @@ extern const int maxMQTTMessageHandlers;
 #define UPDATE_NTP_INTERVAL             10*60*1000
 // Every 3 minutes
 #define RECHECK_WEATHER_INTERVAL        3*60*1000 
+// An SMS worth of report, plus the terminator
+#define WEATHER_REPORT_LEN              161
+// "imperial" or "metric", plus the terminator
+#define UNIT_TYPE_LEN                   9
+// "Sun." through "Sat.", plus the terminator
+#define DAYS_PER_WEEK                   7
+#define DAY_NAME_LEN                    5
 
 /* 
  *  Weather observation struct.  Not sure if you would like to expand
@@ -80,43 +90,48 @@ public:
                 const char* unit_type_in,
                 const char* twilio_topic_in,
                 const char* shadow_topic_in,
+                const char* telemetry_topic_in,
                 TwilioLambdaHelper& lambdaHelperIn
         );
 
         /* Heartbeat function - every loop we need to do maintenance in here */
         void yield();
 
-        /* Return contents of last sensor check. */
-        String get_weather_report(String intro="");
+        /* Write the last sensor check into buffer, returning its length */
+        size_t get_weather_report(
+                char* buffer,
+                const size_t& buffer_len,
+                PGM_P intro=NULL
+        );
 
-        /* Check the sensors and print the latest check */
+        /* Check the sensors, print and batch the latest check */
         void make_observation(WObservation& obs);
         void print_observation(const WObservation& obs);
 
         /* Getters and Setters */
         void update_alarm(const int32_t& alarm_in);
-        void update_units(String units_in);
+        void update_units(const char* units_in);
         void update_alt(const int32_t& alt_in);
         void update_tz(const int32_t& tz_in);
-        void update_tnum(String tnum_in);
-        void update_mnum(String mnum_in);
+        void update_tnum(const char* tnum_in);
+        void update_mnum(const char* mnum_in);
 
         /* Report current shadow state (and possibly get a delta) */
         void report_shadow_state(const char* topic);
 
         /* Set a desired shadow state, new alarms, etc. */
         void update_shadow_state(
-                const String& topic,
+                const char* topic,
                 const int32_t& new_alarm,
-                const String& new_units,
+                const char* new_units,
                 const int32_t& new_alt,
                 const int32_t& new_tz,
-                const String& new_tnum,
-                const String& new_mnum
+                const char* new_tnum,
+                const char* new_mnum
         );
 
-        /* Int to day string mapping */
-        static const char* int_to_day(int int_day);
+        /* Int to day string mapping - the name is in flash (PROGMEM) */
+        static PGM_P int_to_day(int int_day);
         
 private:
         void _display_bmp_sensor_details();
@@ -129,6 +144,11 @@ private:
             const int& altitude
             );
         float _in_to_mm(const float& inches);
+        static bool _copy_number(
+                char* number,
+                const char* number_in,
+                const char* name
+        );
 
         /* 
          *  We're keeping a TwilioLambdaHelper reference to 
@@ -150,19 +170,22 @@ private:
          WObservation                    last_observation;
          uint64_t                        last_weather_check;
 
+        /* Observations waiting to be published to the telemetry topic */
+         TelemetryBatcher                telemetry;
+
         /* Next alarm */
          struct Alarm {
                 int32_t timestamp;
                 bool rang;
         } next_alarm;
 
-        /* Preferences */
+        /* Preferences - sized up front, so updates never allocate */
         int32_t location_altitude;
         int32_t time_zone_offset;
-        String master_number;
-        String twilio_device_number;
-        String unit_type;
-        String shadow_topic;
-        String twilio_topic;
+        char master_number[E164_MAX_LEN];
+        char twilio_device_number[E164_MAX_LEN];
+        char unit_type[UNIT_TYPE_LEN];
+        const char* shadow_topic;
+        const char* twilio_topic;
 
 };
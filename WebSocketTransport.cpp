@@ -0,0 +1,43 @@
+#include "WebSocketTransport.hpp"
+
+/* WebSocketTransport constructor - the handshake waits for connect(). */
+WebSocketTransport::WebSocketTransport(
+        const char* aws_region_in,
+        const char* aws_key_in,
+        const char* aws_secret_in,
+        const char* aws_endpoint_in,
+        const uint16_t& ssl_port_in
+)
+        : MqttTransport(aws_endpoint_in, ssl_port_in)
+        , awsWSclient(WEBSOCKET_BUFFER_SIZE)
+        , presigner(aws_region_in, aws_key_in, aws_secret_in)
+        , aws_region(aws_region_in)
+        , aws_key(aws_key_in)
+        , aws_secret(aws_secret_in)
+        , aws_endpoint(aws_endpoint_in)
+{
+}
+
+
+/*
+ * TLS, then the signed WebSocket upgrade.  The WebSocket library makes its
+ * own TLS client, so there is no session to offer - every handshake here
+ * is a full one.
+ *
+ * With the clock set we hand the library a path we presigned with the
+ * cached key; before that it signs for itself.  A NULL path clears the one
+ * from an earlier connect, so an expired signature is never reused.
+ */
+int WebSocketTransport::_open(const char* host, uint16_t port)
+{
+        awsWSclient.setAWSRegion(aws_region);
+        awsWSclient.setAWSDomain(aws_endpoint);
+        awsWSclient.setAWSKeyID(aws_key);
+        awsWSclient.setAWSSecretKey(aws_secret);
+        awsWSclient.setUseSSL(true);
+
+        const char* signed_path = presigner.presign(host, port, time(nullptr));
+        awsWSclient.setPath(signed_path);
+
+        return awsWSclient.connect(host, port);
+}
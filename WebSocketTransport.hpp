@@ -0,0 +1,52 @@
+#pragma once
+
+#include <WebSocketsClient.h>
+
+// AWS WebSocket Client
+#include "AWSWebSocketClient.h"
+
+#include "MqttTransport.hpp"
+#include "SigV4Presigner.hpp"
+
+/* WebSocket Transport Definitions */
+// AWSWebSocketClient receive buffer
+#define WEBSOCKET_BUFFER_SIZE           1000
+
+
+/*
+ * MQTT over WebSockets on 443, the connection signed with SigV4 from an
+ * IAM key pair.  Works through most firewalls, at the cost of a WebSocket
+ * frame (and possibly its own TLS record) on every packet.
+ *
+ * We presign the URL ourselves so the SigV4 signing key is derived once a
+ * day rather than on every connect.
+ */
+class WebSocketTransport : public MqttTransport {
+public:
+        WebSocketTransport(
+                const char* aws_region_in,
+                const char* aws_key_in,
+                const char* aws_secret_in,
+                const char* aws_endpoint_in,
+                const uint16_t& ssl_port_in=443
+        );
+
+        virtual const char* name() const { return "wss"; }
+
+        /* Signing statistics */
+        const SigV4Stats& sigv4_stats() const { return presigner.stats(); }
+
+protected:
+        virtual Client& _stream() { return awsWSclient; }
+        virtual int _open(const char* host, uint16_t port);
+
+private:
+        AWSWebSocketClient              awsWSclient;
+        SigV4Presigner                  presigner;
+
+        /* AWS Settings */
+        const char*                     aws_region;
+        const char*                     aws_key;
+        const char*                     aws_secret;
+        const char*                     aws_endpoint;
+};
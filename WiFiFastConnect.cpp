@@ -0,0 +1,131 @@
+#include "WiFiFastConnect.hpp"
+
+#include <coredecls.h>
+
+/* WiFiFastConnect constructor */
+WiFiFastConnect::WiFiFastConnect()
+        : wait_callback(NULL)
+{
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/* Try the cached AP and lease, then fall back to scan and DHCP */
+void WiFiFastConnect::connect(const char* ssid, const char* password)
+{
+        uint32_t start = millis();
+
+        // We keep our own cache - don't wear the flash with the SDK's.
+        WiFi.persistent(false);
+        WiFi.mode(WIFI_STA);
+
+        RtcImage image;
+        if (_load(image)) {
+                counters.fast_attempts++;
+                WiFi.config(
+                        IPAddress(image.ip),
+                        IPAddress(image.gateway),
+                        IPAddress(image.subnet),
+                        IPAddress(image.dns)
+                );
+                WiFi.begin(ssid, password, image.channel, image.bssid);
+                if (_wait(WIFI_FAST_TIMEOUT, false)) {
+                        counters.fast_successes++;
+                        counters.last_was_fast = true;
+                        counters.last_connect_time = millis() - start;
+                        return;
+                }
+
+                // Stale - forget it and do this the long way.
+                _clear();
+                WiFi.disconnect();
+                WiFi.config(0U, 0U, 0U);
+        }
+
+        WiFi.begin(ssid, password);
+        _wait(0, true);
+        counters.full_connects++;
+        counters.last_was_fast = false;
+        counters.last_connect_time = millis() - start;
+        _save();
+}
+
+
+/* Run a function while we wait - setup() keeps the log moving with it */
+void WiFiFastConnect::set_wait_callback(void (*callback)())
+{
+        wait_callback = callback;
+}
+
+
+/* Wait for a connection, forever if timeout is 0 */
+bool WiFiFastConnect::_wait(const uint32_t& timeout, const bool& progress)
+{
+        uint32_t start = millis();
+        uint32_t last_dot = start;
+        while (WiFi.status() != WL_CONNECTED) {
+                if (timeout != 0 and millis() - start >= timeout) {
+                        return false;
+                }
+                if (wait_callback != NULL) {
+                        wait_callback();
+                }
+                delay(WIFI_POLL_INTERVAL);
+                if (progress and millis() - last_dot >= 1000) {
+                        LOG_INFO(LOG_NET, ".");
+                        last_dot = millis();
+                }
+        }
+        return true;
+}
+
+
+/* Read the cache from RTC memory - false if it's missing or corrupt */
+bool WiFiFastConnect::_load(RtcImage& image)
+{
+        if (!ESP.rtcUserMemoryRead(
+                WIFI_CACHE_RTC_OFFSET,
+                (uint32_t*)&image,
+                sizeof(image)
+        )) {
+                return false;
+        }
+        return image.magic == WIFI_CACHE_RTC_MAGIC and
+               image.crc == crc32(
+                       &image.magic,
+                       sizeof(image) - sizeof(image.crc)
+               );
+}
+
+
+/* Remember the AP and the lease we just got */
+void WiFiFastConnect::_save()
+{
+        RtcImage image;
+        memset(&image, 0, sizeof(image));
+        image.magic = WIFI_CACHE_RTC_MAGIC;
+        memcpy(image.bssid, WiFi.BSSID(), sizeof(image.bssid));
+        image.channel = WiFi.channel();
+        image.ip = (uint32_t)WiFi.localIP();
+        image.gateway = (uint32_t)WiFi.gatewayIP();
+        image.subnet = (uint32_t)WiFi.subnetMask();
+        image.dns = (uint32_t)WiFi.dnsIP();
+        image.crc = crc32(
+                &image.magic,
+                sizeof(image) - sizeof(image.crc)
+        );
+        ESP.rtcUserMemoryWrite(
+                WIFI_CACHE_RTC_OFFSET,
+                (uint32_t*)&image,
+                sizeof(image)
+        );
+}
+
+
+/* Break the CRC so the next boot does a full connect */
+void WiFiFastConnect::_clear()
+{
+        uint32_t zero = 0;
+        ESP.rtcUserMemoryWrite(WIFI_CACHE_RTC_OFFSET, &zero, sizeof(zero));
+}
+
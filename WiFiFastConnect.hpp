@@ -0,0 +1,73 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+#include "Log.hpp"
+
+/* WiFi Fast Connect Definitions */
+// RTC user memory block (4 bytes each) for the cache - after the TLS session
+#define WIFI_CACHE_RTC_OFFSET           32
+#define WIFI_CACHE_RTC_MAGIC            0x57494631
+// Give the cached BSSID and IP this long before falling back to a scan
+#define WIFI_FAST_TIMEOUT               3000
+// How often we check for a connection
+#define WIFI_POLL_INTERVAL              20
+
+
+/* How the last few connects went */
+struct WiFiConnectStats {
+        uint32_t        fast_attempts;
+        uint32_t        fast_successes;
+        uint32_t        full_connects;
+        uint32_t        last_connect_time;
+        bool            last_was_fast;
+};
+
+
+/*
+ * WiFiFastConnect remembers the access point (BSSID and channel) and the
+ * DHCP lease from the last good connection in RTC user memory.  Next time
+ * it joins that access point directly with that address, skipping the
+ * channel scan and the DHCP exchange - the bulk of a normal connect.
+ *
+ * If the fast path doesn't come up in WIFI_FAST_TIMEOUT (the AP moved
+ * channel, or the lease went to someone else), the cache is dropped and we
+ * do a full scan with DHCP.  RTC memory survives deep sleep and resets,
+ * but not a power cycle - then we simply start with a full connect.
+ */
+class WiFiFastConnect {
+public:
+        WiFiFastConnect();
+
+        /*
+         * Join the network, fast path first.  Blocks until connected,
+         * logging a dot a second on the slow path.
+         */
+        void connect(const char* ssid, const char* password);
+
+        /* Called every WIFI_POLL_INTERVAL while connect() waits */
+        void set_wait_callback(void (*callback)());
+
+        const WiFiConnectStats& stats() const { return counters; }
+
+private:
+        struct RtcImage {
+                uint32_t        crc;
+                uint32_t        magic;
+                uint8_t         bssid[6];
+                uint8_t         channel;
+                uint8_t         reserved;
+                uint32_t        ip;
+                uint32_t        gateway;
+                uint32_t        subnet;
+                uint32_t        dns;
+        };
+
+        bool _load(RtcImage& image);
+        void _save();
+        void _clear();
+        bool _wait(const uint32_t& timeout, const bool& progress);
+
+        void                            (*wait_callback)();
+        WiFiConnectStats                counters;
+};
@@ -0,0 +1,70 @@
+#include "TwilioLambdaHelper.hpp"
+#include "WorkQueue.hpp"
+
+/* WorkQueue constructor - empty ring. */
+WorkQueue::WorkQueue()
+        : head(0)
+        , tail(0)
+{
+        memset(&counters, 0, sizeof(counters));
+}
+
+
+/* Copy a payload into the next free item */
+bool WorkQueue::push(
+        const WorkType& type,
+        const void* payload,
+        const size_t& length
+)
+{
+        if (length >= maxMQTTpackageSize) {
+                counters.dropped_oversize++;
+                return false;
+        }
+
+        if (depth() >= WORK_QUEUE_DEPTH) {
+                counters.dropped_full++;
+                return false;
+        }
+
+        WorkItem& item = items[tail % WORK_QUEUE_DEPTH];
+        item.type = type;
+        item.length = length;
+        memcpy(item.payload, payload, length);
+        item.payload[length] = '\0';
+
+        tail++;
+        counters.enqueued++;
+        if (depth() > counters.max_depth) {
+                counters.max_depth = depth();
+        }
+        return true;
+}
+
+
+/* Peek at the oldest item */
+WorkItem* WorkQueue::front()
+{
+        if (head == tail) {
+                return NULL;
+        }
+        return &items[head % WORK_QUEUE_DEPTH];
+}
+
+
+/* Release the oldest item */
+void WorkQueue::pop()
+{
+        if (head == tail) {
+                return;
+        }
+        head++;
+        counters.processed++;
+}
+
+
+/* Items waiting */
+uint8_t WorkQueue::depth() const
+{
+        return (uint8_t)(tail - head);
+}
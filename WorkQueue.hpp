@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Arduino.h>
+
+extern const int maxMQTTpackageSize;
+
+/* Work Queue Definitions */
+// Messages we can hold between an MQTT callback and the main loop - must be
+// a power of two
+#define WORK_QUEUE_DEPTH                4
+
+
+/* What to do with a work item's payload */
+enum WorkType {
+        WORK_TWILIO_MESSAGE = 0,
+        WORK_SHADOW_UPDATE,
+        WORK_SHADOW_DELTA,
+        WORK_PROFILE_DUMP
+};
+
+
+/* One deferred message - the payload is a NUL terminated copy */
+struct WorkItem {
+        WorkType        type;
+        uint16_t        length;
+        char            payload[maxMQTTpackageSize];
+};
+
+
+/* Counters for the work queue - they only go up */
+struct WorkQueueStats {
+        uint32_t        enqueued;
+        uint32_t        processed;
+        uint32_t        dropped_full;
+        uint32_t        dropped_oversize;
+        uint8_t         max_depth;
+};
+
+
+/*
+ * A fixed-size single producer, single consumer ring of WorkItems.
+ *
+ * MQTT callbacks run inside the Paho client's receive loop.  Publishing
+ * from there nests a send inside a receive, holds off every other inbound
+ * message and risks re-entering the client.  So the callbacks only copy the
+ * payload in here, and loop() drains the queue once handleRequests() has
+ * returned.
+ *
+ * The producer only writes 'tail' and the consumer only writes 'head', so
+ * the queue stays consistent without locks.  Both count up freely and wrap
+ * at 256, which WORK_QUEUE_DEPTH divides evenly.
+ */
+class WorkQueue {
+public:
+        WorkQueue();
+
+        /* Producer side - copy a payload in.  False if it was dropped. */
+        bool push(
+                const WorkType& type,
+                const void* payload,
+                const size_t& length
+        );
+
+        /* Consumer side - oldest item, or NULL if empty */
+        WorkItem* front();
+
+        /* Consumer side - done with the front item */
+        void pop();
+
+        uint8_t depth() const;
+
+        const WorkQueueStats& stats() const { return counters; }
+
+private:
+        WorkItem                        items[WORK_QUEUE_DEPTH];
+        volatile uint8_t                head;
+        volatile uint8_t                tail;
+
+        WorkQueueStats                  counters;
+};
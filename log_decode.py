@@ -0,0 +1,168 @@
+"""
+Decode tokenized log output from the weather station.
+
+With LOG_TOKENIZED set in Log.hpp the station sends binary records - a
+token for the format string plus the raw arguments - instead of text.  We
+rebuild the token table by hashing every LOG_* format string in the
+sketch's sources, then turn the records back into lines.
+
+Usage:
+    python log_decode.py <capture file> [source directory]
+    python log_decode.py /dev/ttyUSB0 [source directory]   (needs pyserial)
+
+Anything between records (boot noise, '[N log lines dropped]' notes) is
+passed through as text.
+"""
+from __future__ import print_function
+
+import glob
+import os
+import re
+import struct
+import sys
+
+SYNC = 0xa5
+
+# LOG_LEVEL(CATEGORY, "format" "more format", ...) - adjacent literals join
+LOG_CALL = re.compile(
+    r'LOG_(?:ERROR|WARN|INFO|DEBUG)\(\s*\w+\s*,\s*((?:"(?:[^"\\]|\\.)*"\s*)+)'
+)
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+ESCAPES = {'n': '\n', 'r': '\r', 't': '\t', '"': '"', '\\': '\\', "'": "'"}
+
+
+def fnv1a(data):
+    """ Same 32 bit FNV-1a as log_token() in LogTokens.hpp """
+    h = 2166136261
+    for b in bytearray(data):
+        h = ((h ^ b) * 16777619) & 0xffffffff
+    return h
+
+
+def unescape(literal):
+    """ C string literal body to the bytes the compiler would hash """
+    out = []
+    i = 0
+    while i < len(literal):
+        c = literal[i]
+        if c == '\\' and i + 1 < len(literal):
+            out.append(ESCAPES.get(literal[i + 1], literal[i + 1]))
+            i += 2
+        else:
+            out.append(c)
+            i += 1
+    return ''.join(out)
+
+
+def load_formats(source_dir):
+    """ token -> format string, from every .cpp, .hpp and .ino """
+    formats = {}
+    for ext in ('*.cpp', '*.hpp', '*.ino'):
+        for path in glob.glob(os.path.join(source_dir, ext)):
+            with open(path) as f:
+                text = f.read()
+            for call in LOG_CALL.finditer(text):
+                fmt = ''.join(
+                    unescape(m.group(1))
+                    for m in LITERAL.finditer(call.group(1))
+                )
+                formats[fnv1a(fmt.encode('utf-8'))] = fmt
+    return formats
+
+
+def parse_record(data, pos):
+    """ Returns (token, args, next position), or None if incomplete """
+    if pos + 6 > len(data):
+        return None
+    token, argc = struct.unpack_from('<IB', data, pos + 1)
+    pos += 6
+    args = []
+    for _ in range(argc):
+        if pos >= len(data):
+            return None
+        kind = chr(data[pos])
+        pos += 1
+        if kind in 'iuf':
+            if pos + 4 > len(data):
+                return None
+            code = {'i': '<i', 'u': '<I', 'f': '<f'}[kind]
+            args.append(struct.unpack_from(code, data, pos)[0])
+            pos += 4
+        elif kind == 's':
+            if pos >= len(data):
+                return None
+            n = data[pos]
+            if pos + 1 + n > len(data):
+                return None
+            args.append(bytes(data[pos + 1:pos + 1 + n]).decode(
+                'utf-8', 'replace'
+            ))
+            pos += 1 + n
+        else:
+            # Truncated on the device - show what we have.
+            args.append('<cut>')
+            pos -= 1
+            break
+    return token, args, pos
+
+
+def render(formats, token, args):
+    fmt = formats.get(token)
+    if fmt is None:
+        return '<unknown token %08x> %r' % (token, args)
+    try:
+        return (fmt % tuple(args)).rstrip('\r\n')
+    except (TypeError, ValueError):
+        return '%s %r' % (fmt.rstrip('\r\n'), args)
+
+
+def decode(data, formats, emit):
+    """ Decode what we can; returns the unconsumed tail """
+    pos = 0
+    text = bytearray()
+    while pos < len(data):
+        if data[pos] != SYNC:
+            text.append(data[pos])
+            pos += 1
+            continue
+        record = parse_record(data, pos)
+        if record is None:
+            break
+        if text:
+            emit(text.decode('utf-8', 'replace').rstrip('\r\n'))
+            text = bytearray()
+        token, args, pos = record
+        emit(render(formats, token, args))
+    if text:
+        emit(text.decode('utf-8', 'replace').rstrip('\r\n'))
+    return data[pos:]
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__)
+        return 1
+    source_dir = argv[2] if len(argv) > 2 else os.path.dirname(
+        os.path.abspath(__file__)
+    )
+    formats = load_formats(source_dir)
+
+    def emit(line):
+        if line:
+            print(line)
+
+    if os.path.isfile(argv[1]):
+        with open(argv[1], 'rb') as f:
+            decode(bytearray(f.read()), formats, emit)
+        return 0
+
+    import serial
+    port = serial.Serial(argv[1], 115200, timeout=0.2)
+    pending = bytearray()
+    while True:
+        pending += bytearray(port.read(256))
+        pending = decode(pending, formats, emit)
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
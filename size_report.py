@@ -0,0 +1,113 @@
+"""
+Compare flash and RAM use across builds of the sketch.
+
+Each build is a git revision, optionally with extra compiler flags after a
+colon.  Every build is exported to a scratch directory and compiled with
+arduino-cli.  We print the "Sketch uses" (flash) and "Global variables use"
+(RAM) figures side by side, with the difference from the first build.
+
+Usage:
+    python size_report.py [--fqbn FQBN] BUILD [BUILD ...]
+
+    python size_report.py HEAD:-DLOG_LEVEL=0 HEAD:-DLOG_LEVEL=4 3ffb5fb~1
+
+Revisions that count allocations in malloc() (HEAP_TRACK_MALLOC in
+HeapMetrics.hpp) get the -Wl,--wrap flags they need to link.
+"""
+from __future__ import print_function
+
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+SKETCH = 'twilio-weather-station-esp8266-iot'
+DEFAULT_FQBN = 'esp8266:esp8266:thing'
+WRAP_FLAGS = '-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free'
+
+FLASH = re.compile(r'Sketch uses (\d+) bytes')
+RAM = re.compile(r'Global variables use (\d+) bytes')
+
+
+def export(revision, directory):
+    """Write the tree at revision into directory/SKETCH."""
+    target = os.path.join(directory, SKETCH)
+    os.makedirs(target)
+    archive = subprocess.Popen(
+        ['git', 'archive', '--format=tar', revision],
+        stdout=subprocess.PIPE
+    )
+    subprocess.check_call(['tar', '-x', '-C', target], stdin=archive.stdout)
+    archive.stdout.close()
+    if archive.wait() != 0:
+        raise RuntimeError('git archive %s failed' % revision)
+    return target
+
+
+def wraps_malloc(sketch):
+    """Does this tree count allocations in malloc()?"""
+    header = os.path.join(sketch, 'HeapMetrics.hpp')
+    if not os.path.exists(header):
+        return False
+    with open(header) as source:
+        return 'HEAP_TRACK_MALLOC' in source.read()
+
+
+def compile_sizes(sketch, fqbn, cpp_flags):
+    """Build the sketch and return (flash bytes, RAM bytes)."""
+    command = ['arduino-cli', 'compile', '-b', fqbn]
+    if cpp_flags:
+        command += [
+            '--build-property', 'compiler.cpp.extra_flags=' + cpp_flags
+        ]
+    if wraps_malloc(sketch):
+        command += [
+            '--build-property', 'compiler.c.elf.extra_flags=' + WRAP_FLAGS
+        ]
+    output = subprocess.check_output(command + [sketch])
+    output = output.decode('utf-8', 'replace')
+
+    flash = FLASH.search(output)
+    ram = RAM.search(output)
+    if flash is None or ram is None:
+        raise RuntimeError('no size lines in:\n' + output)
+    return int(flash.group(1)), int(ram.group(1))
+
+
+def main(argv):
+    fqbn = DEFAULT_FQBN
+    if len(argv) > 2 and argv[1] == '--fqbn':
+        fqbn = argv[2]
+        argv = argv[:1] + argv[3:]
+    builds = argv[1:]
+    if not builds:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+
+    rows = []
+    scratch = tempfile.mkdtemp()
+    try:
+        for i, build in enumerate(builds):
+            revision, _, cpp_flags = build.partition(':')
+            sketch = export(revision, os.path.join(scratch, str(i)))
+            flash, ram = compile_sizes(sketch, fqbn, cpp_flags)
+            rows.append((build, flash, ram))
+    finally:
+        shutil.rmtree(scratch)
+
+    width = max(len(build) for build, _, _ in rows)
+    print('%-*s  %8s  %7s  %8s  %7s' %
+          (width, 'build', 'flash', '+/-', 'RAM', '+/-'))
+    for build, flash, ram in rows:
+        print('%-*s  %8d  %+7d  %8d  %+7d' % (
+            width, build,
+            flash, flash - rows[0][1],
+            ram, ram - rows[0][2]
+        ))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,167 @@
+#pragma once
+
+/*
+ * The WebSocket client over the stub TLS client.  Like arduinoWebSockets
+ * it sends each frame's header and payload in separate writes, so every
+ * MQTT packet costs two TLS records, and it masks what it sends.
+ */
+#include <WiFiClientSecureBearSSL.h>
+
+// How long connect() waits for the 101
+#define AWS_WS_UPGRADE_TIMEOUT          5000
+
+
+class AWSWebSocketClient : public Client {
+public:
+        AWSWebSocketClient(unsigned int buffer_size)
+                : path(NULL)
+                , frame_left(0)
+        {
+                (void)buffer_size;
+        }
+
+        void setAWSRegion(const char* region) { (void)region; }
+        void setAWSDomain(const char* domain) { (void)domain; }
+        void setAWSKeyID(const char* key) { (void)key; }
+        void setAWSSecretKey(const char* secret) { (void)secret; }
+        void setUseSSL(bool use_ssl) { (void)use_ssl; }
+        void setPath(const char* path_in) { path = path_in; }
+
+        virtual int connect(IPAddress ip, uint16_t port)
+        {
+                (void)ip;
+                (void)port;
+                return 0;
+        }
+
+        /* TLS with no session to offer, then the upgrade */
+        virtual int connect(const char* host, uint16_t port)
+        {
+                tls.stop();
+                frame_left = 0;
+                tls.connect(host, port);
+                loopback_broker.expect_websocket();
+
+                char request[640];
+                int len = snprintf(
+                        request,
+                        sizeof(request),
+                        "GET %s HTTP/1.1\r\n"
+                        "Host: %s:%u\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Upgrade: websocket\r\n"
+                        "Sec-WebSocket-Version: 13\r\n"
+                        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                        "Sec-WebSocket-Protocol: mqtt\r\n"
+                        "Origin: file://\r\n"
+                        "User-Agent: arduino-WebSocket-Client\r\n"
+                        "\r\n",
+                        path != NULL ? path : "/mqtt",
+                        host,
+                        port
+                );
+                if (len <= 0 or (size_t)len >= sizeof(request)) {
+                        return 0;
+                }
+                tls.write((const uint8_t*)request, len);
+
+                uint32_t start = millis();
+                uint8_t matched = 0;
+                while (matched < 4) {
+                        int b = tls.read();
+                        if (b < 0) {
+                                if (millis() - start > AWS_WS_UPGRADE_TIMEOUT) {
+                                        tls.stop();
+                                        return 0;
+                                }
+                                delay(1);
+                                continue;
+                        }
+                        matched = b == "\r\n\r\n"[matched] ? matched + 1 :
+                                  b == '\r' ? 1 : 0;
+                }
+                return 1;
+        }
+
+        virtual size_t write(uint8_t b) { return write(&b, 1); }
+
+        /* One binary frame per write */
+        virtual size_t write(const uint8_t* buf, size_t size)
+        {
+                static const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+                uint8_t header[14];
+                size_t header_len = 2;
+                header[0] = 0x82;
+                if (size < 126) {
+                        header[1] = 0x80 | size;
+                } else if (size < 65536) {
+                        header[1] = 0x80 | 126;
+                        header[header_len++] = size >> 8;
+                        header[header_len++] = size;
+                } else {
+                        header[1] = 0x80 | 127;
+                        for (int shift = 56; shift >= 0; shift -= 8) {
+                                header[header_len++] =
+                                        (uint64_t)size >> shift;
+                        }
+                }
+                memcpy(header + header_len, mask, sizeof(mask));
+                header_len += sizeof(mask);
+
+                uint8_t masked[LOOPBACK_MAX_PACKET];
+                if (size > sizeof(masked) or
+                    tls.write(header, header_len) != header_len) {
+                        return 0;
+                }
+                for (size_t i = 0; i < size; ++i) {
+                        masked[i] = buf[i] ^ mask[i % 4];
+                }
+                return tls.write(masked, size);
+        }
+
+        virtual int available()
+        {
+                _next_frame();
+                int ready = tls.available();
+                return frame_left < (size_t)ready ? frame_left : ready;
+        }
+        virtual int read()
+        {
+                if (available() <= 0) {
+                        return -1;
+                }
+                frame_left--;
+                return tls.read();
+        }
+        virtual int read(uint8_t* buf, size_t size)
+        {
+                size_t got = 0;
+                while (got < size and available() > 0) {
+                        buf[got++] = read();
+                }
+                return got;
+        }
+        virtual int peek()
+        {
+                return available() > 0 ? tls.peek() : -1;
+        }
+        virtual void flush() {}
+        virtual void stop() { tls.stop(); }
+        virtual uint8_t connected() { return tls.connected(); }
+        virtual operator bool() { return connected(); }
+
+private:
+        /* Server frames are short and unmasked: 0x82, then the length */
+        void _next_frame()
+        {
+                if (frame_left > 0 or tls.available() < 2) {
+                        return;
+                }
+                tls.read();
+                frame_left = tls.read() & 0x7f;
+        }
+
+        BearSSL::WiFiClientSecure       tls;
+        const char*                     path;
+        size_t                          frame_left;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+ * Just enough of the ESP8266 Arduino core to run the host tests.  Time only
+ * moves when a test says so, through stub_millis.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+extern uint32_t stub_millis;
+
+inline uint32_t millis() { return stub_millis; }
+inline uint32_t micros() { return stub_millis * 1000; }
+inline void delay(uint32_t ms) { stub_millis += ms; }
+
+#define RANDOM_REG32                    ((uint32_t)rand())
+
+/* Flash strings are plain strings on the host */
+#define PROGMEM
+#define PGM_P                           const char*
+#define PSTR(s)                         (s)
+#define vsnprintf_P                     vsnprintf
+#define snprintf_P                      snprintf
+#define strncpy_P                       strncpy
+#define strlen_P                        strlen
+
+
+class Print {
+public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size) = 0;
+        virtual int availableForWrite() { return 0; }
+};
+
+
+class Stream : public Print {
+public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual void flush() = 0;
+};
+
+
+class IPAddress {
+public:
+        IPAddress(uint32_t address_in=0) : address(address_in) {}
+        operator uint32_t() const { return address; }
+
+private:
+        uint32_t address;
+};
+
+
+class Client : public Stream {
+public:
+        virtual int connect(IPAddress ip, uint16_t port) = 0;
+        virtual int connect(const char* host, uint16_t port) = 0;
+        virtual size_t write(uint8_t b) = 0;
+        virtual size_t write(const uint8_t* buf, size_t size) = 0;
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int read(uint8_t* buf, size_t size) = 0;
+        virtual int peek() = 0;
+        virtual void flush() = 0;
+        virtual void stop() = 0;
+        virtual uint8_t connected() = 0;
+        virtual operator bool() = 0;
+};
+
+
+struct rst_info {
+        uint32_t        reason;
+};
+
+
+class EspClass {
+public:
+        uint32_t getFreeHeap() { return 20000; }
+        uint32_t getMaxFreeBlockSize() { return 12000; }
+        uint8_t getHeapFragmentation() { return 10; }
+        uint32_t getChipId() { return 0x123456; }
+        uint32_t getCycleCount() { return micros() * 80; }
+        rst_info* getResetInfoPtr() { static rst_info info = { 0 }; return &info; }
+        bool rtcUserMemoryRead(uint32_t, uint32_t*, size_t) { return false; }
+        bool rtcUserMemoryWrite(uint32_t, uint32_t*, size_t) { return true; }
+};
+
+extern EspClass ESP;
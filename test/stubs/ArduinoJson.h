@@ -0,0 +1,20 @@
+#pragma once
+
+/* Only the buffer base ScratchJsonBuffer derives from */
+#include <stddef.h>
+
+namespace ArduinoJson {
+namespace Internals {
+
+class JsonBuffer {
+public:
+        virtual ~JsonBuffer() {}
+        virtual void* alloc(size_t bytes) = 0;
+};
+
+template <typename TDerived>
+class JsonBufferBase : public JsonBuffer {
+};
+
+}
+}
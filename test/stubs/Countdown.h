@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Arduino.h>
+
+class Countdown {
+public:
+        Countdown() : end_time(0) {}
+
+private:
+        uint32_t        end_time;
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+/* Declarations only - the host tests never touch the radio */
+#include <Arduino.h>
+
+#define WL_CONNECTED                    3
+
+class WiFiClass {
+public:
+        int status() { return WL_CONNECTED; }
+};
+
+extern WiFiClass WiFi;
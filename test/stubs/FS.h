@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * An in-memory SPIFFS that allocates the way the real one does: begin()
+ * keeps a work buffer and every open() makes a reference counted file
+ * object through operator new.  File contents live in static storage, so
+ * only those two allocations show up in the heap counters.
+ */
+#include <Arduino.h>
+#include <memory>
+
+#define STUB_FS_FILES                   4
+#define STUB_FS_NAME_LEN                32
+#define STUB_FS_FILE_SIZE               (32*1024)
+
+enum SeekMode {
+        SeekSet = 0,
+        SeekCur,
+        SeekEnd
+};
+
+
+struct StubFileData {
+        char            name[STUB_FS_NAME_LEN];
+        bool            exists;
+        size_t          size;
+        uint8_t         data[STUB_FS_FILE_SIZE];
+};
+
+
+struct StubFileImpl {
+        StubFileData*   file;
+        size_t          position;
+        bool            append;
+};
+
+
+class File {
+public:
+        File() {}
+        File(StubFileData* file, const bool& append);
+
+        operator bool() const { return impl.get() != NULL; }
+
+        size_t write(const uint8_t* buf, size_t size);
+        size_t read(uint8_t* buf, size_t size);
+        bool seek(uint32_t pos, SeekMode mode);
+        size_t size() const;
+        void close() { impl.reset(); }
+
+private:
+        std::shared_ptr<StubFileImpl> impl;
+};
+
+
+class FS {
+public:
+        FS() : opens(0), work(NULL) {}
+
+        bool begin();
+        void end();
+        bool exists(const char* path);
+        bool remove(const char* path);
+        File open(const char* path, const char* mode);
+
+        /* Forget every file - between tests */
+        void format();
+
+        /* Calls to open(), so a test can tell when flash was touched */
+        uint32_t                        opens;
+
+private:
+        StubFileData* _find(const char* path);
+
+        uint8_t*                        work;
+        StubFileData                    files[STUB_FS_FILES];
+};
+
+extern FS SPIFFS;
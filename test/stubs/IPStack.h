@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Arduino.h>
+
+class IPStack {
+public:
+        IPStack(Client& client_in) : client(client_in) {}
+
+private:
+        Client&         client;
+};
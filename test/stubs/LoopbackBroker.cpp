@@ -0,0 +1,279 @@
+#include "LoopbackBroker.h"
+
+LoopbackBroker loopback_broker;
+
+
+/* LoopbackBroker constructor - a 100 ms link with nothing on it. */
+LoopbackBroker::LoopbackBroker()
+        : rtt(100)
+        , last_payload_len(0)
+        , open(false)
+        , websocket(false)
+        , sessions_issued(0)
+{
+        last_topic[0] = '\0';
+        memset(&counters, 0, sizeof(counters));
+        tls_close();
+}
+
+
+/* Everything before the first record counts as handshake, not traffic */
+void LoopbackBroker::tls_connect(uint8_t* session_id, uint8_t* session_id_len)
+{
+        tls_close();
+
+        // SYN, SYN-ACK
+        _round_trip();
+
+        bool resumed = *session_id_len == 32 and
+                       session_id[0] == 0xb0 and
+                       session_id[1] != 0 and
+                       session_id[1] <= sessions_issued;
+        if (resumed) {
+                for (uint8_t i = 0; i < LOOPBACK_TLS_RESUMED_RTTS; ++i) {
+                        _round_trip();
+                }
+                counters.resumed_handshakes++;
+        } else {
+                for (uint8_t i = 0; i < LOOPBACK_TLS_FULL_RTTS; ++i) {
+                        _round_trip();
+                }
+                counters.full_handshakes++;
+                memset(session_id, 0, 32);
+                session_id[0] = 0xb0;
+                session_id[1] = ++sessions_issued;
+                *session_id_len = 32;
+        }
+        open = true;
+}
+
+
+/* Drop the connection and anything half read */
+void LoopbackBroker::tls_close()
+{
+        open = false;
+        websocket = false;
+        upgraded = false;
+        upgrade_match = 0;
+        frame_header_len = 0;
+        frame_left = 0;
+        packet_len = 0;
+        packet_want = 0;
+        down.clear();
+}
+
+
+/* A record on the link - take it apart for the layer above TLS */
+void LoopbackBroker::tls_send(const uint8_t* data, const size_t& len)
+{
+        if (!open or len == 0) {
+                return;
+        }
+        counters.bytes_up += len + LOOPBACK_TLS_RECORD_OVERHEAD;
+
+        for (size_t i = 0; i < len; ++i) {
+                if (!websocket) {
+                        _mqtt(data[i]);
+                } else if (!upgraded) {
+                        _upgrade(data[i]);
+                } else {
+                        _websocket(data[i]);
+                }
+        }
+}
+
+
+/* Only what has arrived by now can be read */
+int LoopbackBroker::tls_available() const
+{
+        int arrived = 0;
+        for (size_t i = 0; i < down.size(); ++i) {
+                if (down[i].first > stub_millis) {
+                        break;
+                }
+                arrived++;
+        }
+        return arrived;
+}
+
+
+int LoopbackBroker::tls_read()
+{
+        int b = tls_peek();
+        if (b >= 0) {
+                down.pop_front();
+        }
+        return b;
+}
+
+
+int LoopbackBroker::tls_peek() const
+{
+        if (down.empty() or down.front().first > stub_millis) {
+                return -1;
+        }
+        return down.front().second;
+}
+
+
+void LoopbackBroker::_round_trip()
+{
+        delay(rtt);
+        counters.round_trips++;
+}
+
+
+/* The HTTP upgrade ends with a blank line; answer it with a 101 */
+void LoopbackBroker::_upgrade(const uint8_t& b)
+{
+        static const char end[] = "\r\n\r\n";
+        upgrade_match = b == end[upgrade_match] ? upgrade_match + 1 :
+                        b == end[0] ? 1 : 0;
+        if (upgrade_match < 4) {
+                return;
+        }
+
+        static const char response[] =
+                "HTTP/1.1 101 Switching Protocols\r\n"
+                "Upgrade: websocket\r\n"
+                "Connection: Upgrade\r\n"
+                "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+                "Sec-WebSocket-Protocol: mqtt\r\n"
+                "\r\n";
+        upgraded = true;
+        _reply((const uint8_t*)response, sizeof(response) - 1, false);
+}
+
+
+/* Client frames: 2 byte header, 16 or 64 bit length, 4 byte mask */
+void LoopbackBroker::_websocket(const uint8_t& b)
+{
+        if (frame_left == 0) {
+                frame_header[frame_header_len++] = b;
+                if (frame_header_len < 2) {
+                        return;
+                }
+                uint8_t short_len = frame_header[1] & 0x7f;
+                uint8_t want = 2 + 4 + (short_len == 126 ? 2 :
+                                        short_len == 127 ? 8 : 0);
+                if (frame_header_len < want) {
+                        return;
+                }
+                frame_len = short_len;
+                if (short_len >= 126) {
+                        frame_len = 0;
+                        for (uint8_t i = 2; i < want - 4; ++i) {
+                                frame_len = frame_len << 8 | frame_header[i];
+                        }
+                }
+                frame_left = frame_len;
+                return;
+        }
+
+        // Unmask with the key after the length
+        const uint8_t* mask = frame_header + frame_header_len - 4;
+        uint64_t offset = frame_len - frame_left;
+        _mqtt(b ^ mask[offset % 4]);
+
+        if (--frame_left == 0) {
+                frame_header_len = 0;
+        }
+}
+
+
+/* Fixed header, remaining length, then the rest of the packet */
+void LoopbackBroker::_mqtt(const uint8_t& b)
+{
+        if (packet_len < LOOPBACK_MAX_PACKET) {
+                packet[packet_len] = b;
+        }
+        packet_len++;
+
+        if (packet_want == 0) {
+                if (packet_len < 2 or (b & 0x80) != 0) {
+                        return;
+                }
+                size_t remaining = 0;
+                for (size_t i = packet_len - 1; i >= 1; --i) {
+                        remaining = remaining << 7 | (packet[i] & 0x7f);
+                }
+                packet_want = packet_len + remaining;
+        }
+        if (packet_len >= packet_want) {
+                _packet();
+                packet_len = 0;
+                packet_want = 0;
+        }
+}
+
+
+/* CONNECT, PUBLISH at QoS 0, SUBSCRIBE and PINGREQ */
+void LoopbackBroker::_packet()
+{
+        size_t header = 1;
+        while (packet[header] & 0x80) {
+                header++;
+        }
+        header++;
+
+        switch (packet[0] >> 4) {
+        case 1: {
+                static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+                counters.connects++;
+                _reply(connack, sizeof(connack), websocket);
+                break;
+        }
+        case 3: {
+                size_t topic_len = packet[header] << 8 | packet[header + 1];
+                size_t topic_at = header + 2;
+                size_t payload_at = topic_at + topic_len;
+                if (topic_len >= LOOPBACK_TOPIC_LEN or
+                    packet_len > LOOPBACK_MAX_PACKET) {
+                        break;
+                }
+                memcpy(last_topic, packet + topic_at, topic_len);
+                last_topic[topic_len] = '\0';
+                last_payload_len = packet_len - payload_at;
+                memcpy(last_payload, packet + payload_at, last_payload_len);
+                counters.publishes++;
+                break;
+        }
+        case 8: {
+                uint8_t suback[] = {
+                        0x90, 0x03, packet[header], packet[header + 1], 0x00
+                };
+                _reply(suback, sizeof(suback), websocket);
+                break;
+        }
+        case 12: {
+                static const uint8_t pingresp[] = { 0xd0, 0x00 };
+                _reply(pingresp, sizeof(pingresp), websocket);
+                break;
+        }
+        }
+}
+
+
+/*
+ * Send down one record - in a binary WebSocket frame if we're past the
+ * upgrade - arriving a round trip after the request that caused it.
+ */
+void LoopbackBroker::_reply(
+        const uint8_t* data,
+        const size_t& len,
+        bool framed
+)
+{
+        uint32_t arrives = stub_millis + rtt;
+        size_t record = len;
+        if (framed) {
+                // Server frames aren't masked - everything here is short
+                down.push_back(std::make_pair(arrives, (uint8_t)0x82));
+                down.push_back(std::make_pair(arrives, (uint8_t)len));
+                record += 2;
+        }
+        for (size_t i = 0; i < len; ++i) {
+                down.push_back(std::make_pair(arrives, data[i]));
+        }
+        counters.bytes_down += record + LOOPBACK_TLS_RECORD_OVERHEAD;
+}
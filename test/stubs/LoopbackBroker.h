@@ -0,0 +1,109 @@
+#pragma once
+
+/*
+ * The far end of the stub TLS and WebSocket clients: a broker on a
+ * simulated link.  It takes the TLS records and WebSocket frames apart
+ * the way AWS IoT would, answers MQTT, and counts every byte that crosses
+ * the link, framing included.
+ *
+ * Time is stub_millis.  Every round trip - TCP, TLS, the WebSocket
+ * upgrade, or waiting for a CONNACK - costs rtt milliseconds and nothing
+ * else; the handshake's CPU time on the board isn't modelled.
+ */
+#include <Arduino.h>
+#include <deque>
+
+/* Loopback Broker Definitions */
+// TLS 1.2 AES-GCM record: 5 byte header, 8 byte nonce and 16 byte tag
+#define LOOPBACK_TLS_RECORD_OVERHEAD    29
+// Round trips for a full TLS handshake, and for resuming a session
+#define LOOPBACK_TLS_FULL_RTTS          2
+#define LOOPBACK_TLS_RESUMED_RTTS       1
+#define LOOPBACK_MAX_PACKET             1024
+#define LOOPBACK_TOPIC_LEN              64
+
+
+/* What crossed the link, by direction */
+struct LoopbackStats {
+        /* Bytes on the link after the TLS handshake, framing included */
+        uint32_t        bytes_up;
+        uint32_t        bytes_down;
+
+        uint32_t        round_trips;
+        uint32_t        full_handshakes;
+        uint32_t        resumed_handshakes;
+
+        /* MQTT the broker understood */
+        uint32_t        connects;
+        uint32_t        publishes;
+};
+
+
+class LoopbackBroker {
+public:
+        LoopbackBroker();
+
+        /* Milliseconds per round trip */
+        uint32_t        rtt;
+
+        /*
+         * The client's side of a TLS connect: TCP, then a handshake that
+         * resumes the offered session if the broker issued it.  A new
+         * session ID is written back, as BearSSL does.
+         */
+        void tls_connect(uint8_t* session_id, uint8_t* session_id_len);
+        void tls_close();
+        bool tls_open() const { return open; }
+
+        /* Expect a WebSocket upgrade and frames inside TLS */
+        void expect_websocket() { websocket = true; }
+
+        /* One TLS record up, and the plaintext of the records sent down */
+        void tls_send(const uint8_t* data, const size_t& len);
+        int tls_available() const;
+        int tls_read();
+        int tls_peek() const;
+
+        const LoopbackStats& stats() const { return counters; }
+
+        /* Topic and payload of the last PUBLISH */
+        char            last_topic[LOOPBACK_TOPIC_LEN];
+        uint8_t         last_payload[LOOPBACK_MAX_PACKET];
+        size_t          last_payload_len;
+
+private:
+        void _round_trip();
+        void _upgrade(const uint8_t& b);
+        void _websocket(const uint8_t& b);
+        void _mqtt(const uint8_t& b);
+        void _packet();
+        void _reply(const uint8_t* data, const size_t& len, bool framed);
+
+        bool                            open;
+        bool                            websocket;
+
+        /* Issued TLS sessions are numbered */
+        uint8_t                         sessions_issued;
+
+        /* WebSocket upgrade request: how much of "\r\n\r\n" we've seen */
+        bool                            upgraded;
+        uint8_t                         upgrade_match;
+
+        /* WebSocket frame being read */
+        uint8_t                         frame_header[14];
+        uint8_t                         frame_header_len;
+        uint64_t                        frame_len;
+        uint64_t                        frame_left;
+
+        /* MQTT packet being read */
+        uint8_t                         packet[LOOPBACK_MAX_PACKET];
+        size_t                          packet_len;
+        size_t                          packet_want;
+
+        /* Plaintext down to the client, each byte with when it arrives */
+        std::deque<std::pair<uint32_t, uint8_t> >       down;
+
+        LoopbackStats                   counters;
+};
+
+extern LoopbackBroker loopback_broker;
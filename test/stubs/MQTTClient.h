@@ -0,0 +1,52 @@
+#pragma once
+
+/* The parts of the embedded Paho client our headers name */
+#include <Arduino.h>
+
+struct MQTTLenString {
+        int             len;
+        char*           data;
+};
+
+struct MQTTString {
+        char*           cstring;
+        MQTTLenString   lenstring;
+};
+
+namespace MQTT {
+
+enum QoS { QOS0, QOS1, QOS2 };
+
+struct Message {
+        QoS             qos;
+        bool            retained;
+        bool            dup;
+        unsigned short  id;
+        void*           payload;
+        size_t          payloadlen;
+};
+
+struct MessageData {
+        MessageData(MQTTString& topic_name, Message& message_in)
+                : message(message_in)
+                , topicName(topic_name)
+        {
+        }
+
+        Message&        message;
+        MQTTString&     topicName;
+};
+
+template <class Network, class Timer, int MAX_MQTT_PACKET_SIZE,
+          int MAX_MESSAGE_HANDLERS>
+class Client {
+public:
+        Client(Network& network_in) : network(network_in) {}
+
+private:
+        Network&        network;
+        unsigned char   sendbuf[MAX_MQTT_PACKET_SIZE];
+        unsigned char   readbuf[MAX_MQTT_PACKET_SIZE];
+};
+
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+/* AWSWebSocketClient.h carries the whole WebSocket client on the host */
+#include <Arduino.h>
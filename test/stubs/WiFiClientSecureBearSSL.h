@@ -0,0 +1,130 @@
+#pragma once
+
+/*
+ * A TLS client whose far end is the LoopbackBroker.  Every write() is one
+ * record, as with BearSSL's WiFiClientSecure when it fits the buffer.
+ */
+#include <ESP8266WiFi.h>
+
+#include "LoopbackBroker.h"
+
+struct br_ssl_session_parameters {
+        uint8_t         session_id[32];
+        uint8_t         session_id_len;
+        uint16_t        version;
+        uint16_t        cipher_suite;
+        uint8_t         master_secret[48];
+};
+
+namespace BearSSL {
+
+class Session {
+public:
+        Session() { memset(&session, 0, sizeof(session)); }
+        br_ssl_session_parameters* getSession() { return &session; }
+
+private:
+        br_ssl_session_parameters session;
+};
+
+
+/* Certificates and keys are only carried around */
+class X509List {
+public:
+        X509List(const char* pem=NULL) { (void)pem; }
+};
+
+class PrivateKey {
+public:
+        PrivateKey(const char* pem=NULL) { (void)pem; }
+};
+
+
+class WiFiClientSecure : public Client {
+public:
+        WiFiClientSecure() : session(NULL), open(false) {}
+
+        void setBufferSizes(int recv, int xmit) { (void)recv; (void)xmit; }
+        void setTrustAnchors(const X509List* ta) { (void)ta; }
+        void setClientRSACert(const X509List* cert, const PrivateKey* key)
+        {
+                (void)cert;
+                (void)key;
+        }
+        void setX509Time(time_t now) { (void)now; }
+        void setSession(Session* session_in) { session = session_in; }
+
+        virtual int connect(IPAddress ip, uint16_t port)
+        {
+                (void)ip;
+                (void)port;
+                return 0;
+        }
+
+        /* Resume the session set, if the broker knows it */
+        virtual int connect(const char* host, uint16_t port)
+        {
+                (void)host;
+                (void)port;
+                Session scratch;
+                br_ssl_session_parameters* params =
+                        (session != NULL ? session : &scratch)->getSession();
+                loopback_broker.tls_connect(
+                        params->session_id,
+                        &params->session_id_len
+                );
+                open = true;
+                return 1;
+        }
+
+        virtual size_t write(uint8_t b) { return write(&b, 1); }
+        virtual size_t write(const uint8_t* buf, size_t size)
+        {
+                if (!connected()) {
+                        return 0;
+                }
+                loopback_broker.tls_send(buf, size);
+                return size;
+        }
+
+        virtual int available()
+        {
+                return connected() ? loopback_broker.tls_available() : 0;
+        }
+        virtual int read()
+        {
+                return connected() ? loopback_broker.tls_read() : -1;
+        }
+        virtual int read(uint8_t* buf, size_t size)
+        {
+                size_t got = 0;
+                while (got < size and available() > 0) {
+                        buf[got++] = read();
+                }
+                return got;
+        }
+        virtual int peek()
+        {
+                return connected() ? loopback_broker.tls_peek() : -1;
+        }
+        virtual void flush() {}
+
+        virtual void stop()
+        {
+                if (open) {
+                        loopback_broker.tls_close();
+                }
+                open = false;
+        }
+        virtual uint8_t connected()
+        {
+                return open and loopback_broker.tls_open();
+        }
+        virtual operator bool() { return connected(); }
+
+private:
+        Session*        session;
+        bool            open;
+};
+
+}
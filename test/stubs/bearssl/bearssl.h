@@ -0,0 +1,48 @@
+#pragma once
+
+/*
+ * The slice of BearSSL the sketch uses for SigV4: SHA-256 and HMAC over
+ * it, written out plainly in sha256.cpp so the host tests need no crypto
+ * library.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+struct br_sha256_context {
+        uint32_t        state[8];
+        uint64_t        count;
+        uint8_t         buffer[64];
+};
+
+struct br_hash_class {
+        size_t          block_size;
+};
+
+extern const br_hash_class br_sha256_vtable;
+
+void br_sha256_init(br_sha256_context* ctx);
+void br_sha256_update(br_sha256_context* ctx, const void* data, size_t len);
+void br_sha256_out(const br_sha256_context* ctx, void* out);
+
+struct br_hmac_key_context {
+        uint8_t         key[64];
+};
+
+struct br_hmac_context {
+        br_sha256_context       inner;
+        uint8_t                 key[64];
+};
+
+void br_hmac_key_init(
+        br_hmac_key_context* kc,
+        const br_hash_class* digest_vtable,
+        const void* key,
+        size_t key_len
+);
+void br_hmac_init(
+        br_hmac_context* ctx,
+        const br_hmac_key_context* kc,
+        size_t out_len
+);
+void br_hmac_update(br_hmac_context* ctx, const void* data, size_t len);
+size_t br_hmac_out(const br_hmac_context* ctx, void* out);
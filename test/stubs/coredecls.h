@@ -0,0 +1,20 @@
+#pragma once
+
+/* The core's CRC-32 (reflected, polynomial 0xedb88320) */
+#include <Arduino.h>
+
+inline uint32_t crc32(
+        const void* data,
+        size_t length,
+        uint32_t crc=0xffffffff
+)
+{
+        const uint8_t* bytes = (const uint8_t*)data;
+        while (length--) {
+                crc ^= *bytes++;
+                for (uint8_t bit = 0; bit < 8; ++bit) {
+                        crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+                }
+        }
+        return ~crc;
+}
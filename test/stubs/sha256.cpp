@@ -0,0 +1,183 @@
+#include <string.h>
+
+#include <bearssl/bearssl.h>
+
+/* SHA-256 as in FIPS 180-4, and HMAC as in RFC 2104 */
+
+const br_hash_class br_sha256_vtable = { 64 };
+
+static const uint32_t round_constants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+        0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+        0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+        0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+        0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+static uint32_t rotr(const uint32_t x, const uint8_t n)
+{
+        return (x >> n) | (x << (32 - n));
+}
+
+
+static void sha256_block(uint32_t* state, const uint8_t* block)
+{
+        uint32_t w[64];
+        for (uint8_t i = 0; i < 16; ++i) {
+                w[i] = (uint32_t)block[4*i] << 24 |
+                       (uint32_t)block[4*i + 1] << 16 |
+                       (uint32_t)block[4*i + 2] << 8 |
+                       (uint32_t)block[4*i + 3];
+        }
+        for (uint8_t i = 16; i < 64; ++i) {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^
+                              (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^
+                              (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t v[8];
+        memcpy(v, state, sizeof(v));
+        for (uint8_t i = 0; i < 64; ++i) {
+                uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+                uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+                uint32_t t1 = v[7] + s1 + ch + round_constants[i] + w[i];
+                uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+                uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+                memmove(v + 1, v, 7 * sizeof(uint32_t));
+                v[4] += t1;
+                v[0] = t1 + s0 + maj;
+        }
+        for (uint8_t i = 0; i < 8; ++i) {
+                state[i] += v[i];
+        }
+}
+
+
+void br_sha256_init(br_sha256_context* ctx)
+{
+        static const uint32_t initial[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(ctx->state, initial, sizeof(initial));
+        ctx->count = 0;
+}
+
+
+void br_sha256_update(br_sha256_context* ctx, const void* data, size_t len)
+{
+        const uint8_t* bytes = (const uint8_t*)data;
+        while (len > 0) {
+                size_t used = ctx->count % 64;
+                size_t chunk = 64 - used < len ? 64 - used : len;
+                memcpy(ctx->buffer + used, bytes, chunk);
+                ctx->count += chunk;
+                bytes += chunk;
+                len -= chunk;
+                if (ctx->count % 64 == 0) {
+                        sha256_block(ctx->state, ctx->buffer);
+                }
+        }
+}
+
+
+/* Pad a copy, so the context can keep going - as BearSSL allows */
+void br_sha256_out(const br_sha256_context* ctx, void* out)
+{
+        br_sha256_context done = *ctx;
+        uint64_t bits = done.count * 8;
+        uint8_t pad = 0x80;
+        br_sha256_update(&done, &pad, 1);
+        pad = 0;
+        while (done.count % 64 != 56) {
+                br_sha256_update(&done, &pad, 1);
+        }
+        uint8_t length[8];
+        for (uint8_t i = 0; i < 8; ++i) {
+                length[i] = bits >> (56 - 8*i);
+        }
+        br_sha256_update(&done, length, sizeof(length));
+
+        uint8_t* digest = (uint8_t*)out;
+        for (uint8_t i = 0; i < 8; ++i) {
+                digest[4*i] = done.state[i] >> 24;
+                digest[4*i + 1] = done.state[i] >> 16;
+                digest[4*i + 2] = done.state[i] >> 8;
+                digest[4*i + 3] = done.state[i];
+        }
+}
+
+
+void br_hmac_key_init(
+        br_hmac_key_context* kc,
+        const br_hash_class* digest_vtable,
+        const void* key,
+        size_t key_len
+)
+{
+        (void)digest_vtable;
+        memset(kc->key, 0, sizeof(kc->key));
+        if (key_len > sizeof(kc->key)) {
+                br_sha256_context sha;
+                br_sha256_init(&sha);
+                br_sha256_update(&sha, key, key_len);
+                br_sha256_out(&sha, kc->key);
+        } else {
+                memcpy(kc->key, key, key_len);
+        }
+}
+
+
+void br_hmac_init(
+        br_hmac_context* ctx,
+        const br_hmac_key_context* kc,
+        size_t out_len
+)
+{
+        (void)out_len;
+        memcpy(ctx->key, kc->key, sizeof(ctx->key));
+        uint8_t ipad[64];
+        for (uint8_t i = 0; i < 64; ++i) {
+                ipad[i] = kc->key[i] ^ 0x36;
+        }
+        br_sha256_init(&ctx->inner);
+        br_sha256_update(&ctx->inner, ipad, sizeof(ipad));
+}
+
+
+void br_hmac_update(br_hmac_context* ctx, const void* data, size_t len)
+{
+        br_sha256_update(&ctx->inner, data, len);
+}
+
+
+size_t br_hmac_out(const br_hmac_context* ctx, void* out)
+{
+        uint8_t inner[32];
+        br_sha256_out(&ctx->inner, inner);
+
+        uint8_t opad[64];
+        for (uint8_t i = 0; i < 64; ++i) {
+                opad[i] = ctx->key[i] ^ 0x5c;
+        }
+        br_sha256_context outer;
+        br_sha256_init(&outer);
+        br_sha256_update(&outer, opad, sizeof(opad));
+        br_sha256_update(&outer, inner, sizeof(inner));
+        br_sha256_out(&outer, out);
+        return 32;
+}
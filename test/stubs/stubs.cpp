@@ -0,0 +1,241 @@
+#include <Arduino.h>
+#include <FS.h>
+
+uint32_t stub_millis = 0;
+EspClass ESP;
+FS SPIFFS;
+
+
+/*
+ * The board links with -Wl,--wrap=malloc and friends, so HeapMetrics can
+ * count and seal every allocation.  Here we do the wrapping ourselves: the
+ * C library, libstdc++ and the sketch's code all call these, which call
+ * the __wrap_ versions in HeapMetrics.cpp.  Tests without HeapMetrics get
+ * the pass-throughs.
+ */
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+
+void* __real_malloc(size_t size)
+{
+        return __libc_malloc(size);
+}
+
+void* __real_calloc(size_t count, size_t size)
+{
+        return __libc_calloc(count, size);
+}
+
+void* __real_realloc(void* ptr, size_t size)
+{
+        return __libc_realloc(ptr, size);
+}
+
+void __real_free(void* ptr)
+{
+        __libc_free(ptr);
+}
+
+__attribute__((weak)) void* __wrap_malloc(size_t size)
+{
+        return __real_malloc(size);
+}
+
+__attribute__((weak)) void* __wrap_calloc(size_t count, size_t size)
+{
+        return __real_calloc(count, size);
+}
+
+__attribute__((weak)) void* __wrap_realloc(void* ptr, size_t size)
+{
+        return __real_realloc(ptr, size);
+}
+
+__attribute__((weak)) void __wrap_free(void* ptr)
+{
+        __real_free(ptr);
+}
+
+void* malloc(size_t size)
+{
+        return __wrap_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+        return __wrap_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+        return __wrap_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+        __wrap_free(ptr);
+}
+
+}
+
+
+/*
+ * stdout's buffer is allocated on first use, which may be a test's last
+ * printf() with the heap sealed - give it one up front, like Serial's.
+ */
+static char stdout_buffer[BUFSIZ];
+
+static struct StdoutBuffer {
+        StdoutBuffer()
+        {
+                setvbuf(stdout, stdout_buffer, _IOLBF, sizeof(stdout_buffer));
+        }
+} stdout_buffer_setup;
+
+
+File::File(StubFileData* file, const bool& append)
+        : impl(new StubFileImpl())
+{
+        impl->file = file;
+        impl->position = append ? file->size : 0;
+        impl->append = append;
+}
+
+
+size_t File::write(const uint8_t* buf, size_t size)
+{
+        StubFileData* file = impl->file;
+        if (impl->append) {
+                impl->position = file->size;
+        }
+        if (impl->position + size > STUB_FS_FILE_SIZE) {
+                size = STUB_FS_FILE_SIZE - impl->position;
+        }
+        memcpy(file->data + impl->position, buf, size);
+        impl->position += size;
+        if (impl->position > file->size) {
+                file->size = impl->position;
+        }
+        return size;
+}
+
+
+size_t File::read(uint8_t* buf, size_t size)
+{
+        StubFileData* file = impl->file;
+        if (impl->position + size > file->size) {
+                size = file->size - impl->position;
+        }
+        memcpy(buf, file->data + impl->position, size);
+        impl->position += size;
+        return size;
+}
+
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+        if (mode == SeekCur) {
+                pos += impl->position;
+        } else if (mode == SeekEnd) {
+                pos += impl->file->size;
+        }
+        if (pos > impl->file->size) {
+                return false;
+        }
+        impl->position = pos;
+        return true;
+}
+
+
+size_t File::size() const
+{
+        return impl->file->size;
+}
+
+
+bool FS::begin()
+{
+        if (work == NULL) {
+                work = new uint8_t[256];
+        }
+        return true;
+}
+
+
+void FS::end()
+{
+        delete[] work;
+        work = NULL;
+}
+
+
+bool FS::exists(const char* path)
+{
+        return _find(path) != NULL;
+}
+
+
+bool FS::remove(const char* path)
+{
+        StubFileData* file = _find(path);
+        if (file == NULL) {
+                return false;
+        }
+        file->exists = false;
+        return true;
+}
+
+
+File FS::open(const char* path, const char* mode)
+{
+        opens++;
+        if (work == NULL) {
+                return File();
+        }
+
+        StubFileData* file = _find(path);
+        if (file == NULL) {
+                if (mode[0] == 'r') {
+                        return File();
+                }
+                for (uint8_t i = 0; i < STUB_FS_FILES and file == NULL; ++i) {
+                        if (!files[i].exists) {
+                                file = &files[i];
+                        }
+                }
+                if (file == NULL) {
+                        return File();
+                }
+                strncpy(file->name, path, STUB_FS_NAME_LEN - 1);
+                file->name[STUB_FS_NAME_LEN - 1] = '\0';
+                file->exists = true;
+                file->size = 0;
+        }
+        if (mode[0] == 'w') {
+                file->size = 0;
+        }
+        return File(file, mode[0] == 'a');
+}
+
+
+void FS::format()
+{
+        for (uint8_t i = 0; i < STUB_FS_FILES; ++i) {
+                files[i].exists = false;
+        }
+}
+
+
+StubFileData* FS::_find(const char* path)
+{
+        for (uint8_t i = 0; i < STUB_FS_FILES; ++i) {
+                if (files[i].exists and strcmp(files[i].name, path) == 0) {
+                        return &files[i];
+                }
+        }
+        return NULL;
+}
@@ -0,0 +1,122 @@
+/*
+ * The heap seal sees every allocation, not just new: malloc(), calloc(),
+ * a realloc() that grows a block, and the C library allocating for us, as
+ * String and the network libraries do on the board.  Each one after the
+ * seal has to trip the assert - they run in a forked child, which must die
+ * on it.
+ */
+#include <assert.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../HeapMetrics.hpp"
+
+
+/* Where allocations go, so the compiler keeps them */
+static void* volatile kept = NULL;
+
+
+static void allocate_malloc()
+{
+        kept = malloc(16);
+}
+
+static void allocate_calloc()
+{
+        kept = calloc(4, 4);
+}
+
+static void allocate_realloc()
+{
+        kept = realloc(kept, 64);
+}
+
+static void allocate_strdup()
+{
+        kept = strdup("+14155550100");
+}
+
+static void allocate_new()
+{
+        kept = new char[16];
+}
+
+
+/* Before the seal everything is counted, allocations and frees alike */
+static void test_counted()
+{
+        const AllocationStats& stats = HeapMetrics::allocation_stats();
+        uint32_t allocations = stats.allocations;
+        uint32_t frees = stats.frees;
+
+        allocate_malloc();
+        free(kept);
+        allocate_calloc();
+        free(kept);
+        allocate_strdup();
+        free(kept);
+        allocate_new();
+        delete[] (char*)kept;
+        assert(stats.allocations - allocations == 4);
+        assert(stats.frees - frees == 4);
+
+        // Growing a block is an allocation and a free.
+        allocate_malloc();
+        allocate_realloc();
+        assert(stats.allocations - allocations == 6);
+        assert(stats.frees - frees == 5);
+}
+
+
+/* A HeapSealExemption lets anything through */
+static void test_exempt()
+{
+        HeapSealExemption exempt;
+        void* block = malloc(16);
+        char* copy = strdup("+14155550100");
+        block = realloc(block, 64);
+        free(copy);
+        free(block);
+        assert(HeapMetrics::allocation_stats().after_seal == 0);
+}
+
+
+static void expect_caught(void (*allocate)())
+{
+        pid_t child = fork();
+        assert(child >= 0);
+        if (child == 0) {
+                freopen("/dev/null", "w", stderr);
+                allocate();
+                _exit(0);
+        }
+
+        int status;
+        assert(waitpid(child, &status, 0) == child);
+        assert(WIFSIGNALED(status) and WTERMSIG(status) == SIGABRT);
+}
+
+
+int main()
+{
+        test_counted();
+
+        // The block realloc() grows after the seal
+        allocate_malloc();
+        HeapMetrics::seal();
+
+        test_exempt();
+        expect_caught(allocate_malloc);
+        expect_caught(allocate_calloc);
+        expect_caught(allocate_realloc);
+        expect_caught(allocate_strdup);
+        expect_caught(allocate_new);
+
+        // Freeing is always fine.
+        free(kept);
+        assert(HeapMetrics::allocation_stats().after_seal == 0);
+
+        printf("test_heap_metrics: ok\n");
+        return 0;
+}
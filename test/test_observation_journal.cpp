@@ -0,0 +1,120 @@
+/*
+ * The offline path after setup(): journal telemetry, spill publishes to
+ * flash and read both back, all with the heap sealed.  Any allocation the
+ * seal doesn't allow trips the assert in HeapMetrics::record_alloc().
+ */
+#include <assert.h>
+
+#include "../TwilioLambdaHelper.hpp"
+#include "../ObservationJournal.hpp"
+#include "../HeapMetrics.hpp"
+
+
+static void fill_samples(TelemetrySample* samples, const uint8_t& count)
+{
+        for (uint8_t i = 0; i < count; ++i) {
+                samples[i].epoch = 1600000000 + i * 180;
+                samples[i].temperature_c100 = 2000 + i;
+                samples[i].humidity_c100 = 5000;
+                samples[i].pressure_d10 = 10132;
+        }
+}
+
+
+/* setup() - everything that may allocate happens here */
+static void test_setup(ObservationJournal& journal)
+{
+        assert(journal.begin());
+        assert(journal.pending() == 0);
+        HeapMetrics::seal();
+}
+
+
+static void test_journal_after_seal(ObservationJournal& journal)
+{
+        TelemetrySample samples[8];
+        fill_samples(samples, 8);
+
+        assert(journal.append(samples, 8));
+        assert(journal.append(samples, 8));
+        assert(journal.pending() == 16);
+
+        TelemetrySample read_back[16];
+        assert(journal.peek(read_back, 16) == 16);
+        assert(read_back[9].epoch == samples[1].epoch);
+
+        journal.consume(10);
+        assert(journal.pending() == 6);
+        assert(journal.peek(read_back, 16) == 6);
+        assert(read_back[0].epoch == samples[2].epoch);
+
+        journal.consume(6);
+        assert(journal.pending() == 0);
+        assert(!SPIFFS.exists(JOURNAL_FILE));
+}
+
+
+/*
+ * A reset with samples in the journal - begin() picks them back up.  This
+ * is all boot time, so it runs before the seal.
+ */
+static void test_journal_survives_reset()
+{
+        TelemetrySample samples[4];
+        fill_samples(samples, 4);
+
+        ObservationJournal before;
+        assert(before.begin());
+        assert(before.append(samples, 4));
+        before.consume(1);
+
+        ObservationJournal after;
+        assert(after.begin());
+        assert(after.pending() == 3);
+        TelemetrySample read_back[4];
+        assert(after.peek(read_back, 4) == 3);
+        assert(read_back[0].epoch == samples[1].epoch);
+        after.consume(3);
+}
+
+
+static void test_spill_after_seal()
+{
+        OutboundQueue queue;
+        char payload[32];
+
+        // More telemetry than its RAM quota - the rest goes to flash.
+        for (uint8_t i = 0; i < OUTBOUND_TELEMETRY_SLOTS + 3; ++i) {
+                snprintf(payload, sizeof(payload), "{\"n\":%u}", i);
+                assert(queue.push(OUTBOUND_TELEMETRY, "t", payload));
+        }
+        assert(queue.stats().spilled == 3);
+        assert(queue.depth(OUTBOUND_TELEMETRY) == OUTBOUND_TELEMETRY_SLOTS + 3);
+
+        // Sending pulls them back in, in order.
+        for (uint8_t i = 0; i < OUTBOUND_TELEMETRY_SLOTS + 3; ++i) {
+                OutboundMessage* msg = queue.due(OUTBOUND_TELEMETRY);
+                assert(msg != NULL);
+                snprintf(payload, sizeof(payload), "{\"n\":%u}", i);
+                assert(strcmp(msg->payload, payload) == 0);
+                queue.pop(OUTBOUND_TELEMETRY);
+        }
+        assert(queue.depth() == 0);
+}
+
+
+int main()
+{
+        SPIFFS.format();
+        test_journal_survives_reset();
+
+        ObservationJournal journal;
+        test_setup(journal);
+
+        test_journal_after_seal(journal);
+        test_spill_after_seal();
+
+        assert(HeapMetrics::allocation_stats().after_seal == 0);
+        printf("test_observation_journal: ok\n");
+        return 0;
+}
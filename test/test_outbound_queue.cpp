@@ -0,0 +1,175 @@
+/*
+ * Class quotas over the shared slot pool: when bulk traffic has filled it,
+ * an alarm still gets a slot and goes out first.  Also what push() will
+ * take - a message has to fit in one MQTT packet.
+ */
+#include <assert.h>
+#include <FS.h>
+
+#include "../TwilioLambdaHelper.hpp"
+
+
+static void push_numbered(
+        OutboundQueue& queue,
+        const OutboundPriority& priority,
+        const uint8_t& n
+)
+{
+        char payload[32];
+        snprintf(payload, sizeof(payload), "{\"n\":%u}", n);
+        assert(queue.push(priority, "t", payload));
+}
+
+
+static void expect_numbered(
+        OutboundQueue& queue,
+        const OutboundPriority& priority,
+        const uint8_t& n
+)
+{
+        char payload[32];
+        snprintf(payload, sizeof(payload), "{\"n\":%u}", n);
+        OutboundMessage* msg = queue.due(priority);
+        assert(msg != NULL);
+        assert(strcmp(msg->payload, payload) == 0);
+        queue.pop(priority);
+}
+
+
+static void test_alarm_behind_bulk()
+{
+        OutboundQueue queue;
+
+        // Replies and telemetry up to their quotas fill the pool.
+        for (uint8_t i = 0; i < OUTBOUND_REPLY_SLOTS; ++i) {
+                push_numbered(queue, OUTBOUND_REPLY, i);
+        }
+        for (uint8_t i = 0; i < OUTBOUND_TELEMETRY_SLOTS; ++i) {
+                push_numbered(queue, OUTBOUND_TELEMETRY, i);
+        }
+        assert(OUTBOUND_REPLY_SLOTS + OUTBOUND_TELEMETRY_SLOTS ==
+               OUTBOUND_QUEUE_DEPTH);
+        assert(queue.stats().spilled == 0);
+
+        // The alarm takes the youngest telemetry's slot, which goes to flash.
+        push_numbered(queue, OUTBOUND_ALARM, 0);
+        assert(queue.due(OUTBOUND_ALARM) != NULL);
+        assert(queue.stats().evicted == 1);
+        assert(queue.stats().spilled == 1);
+        assert(queue.stats().dropped_full == 0);
+        assert(queue.depth(OUTBOUND_TELEMETRY) == OUTBOUND_TELEMETRY_SLOTS);
+
+        // Telemetry pushed now queues behind the evicted message.
+        push_numbered(queue, OUTBOUND_TELEMETRY, OUTBOUND_TELEMETRY_SLOTS);
+        assert(queue.stats().evicted == 1);
+
+        expect_numbered(queue, OUTBOUND_ALARM, 0);
+        for (uint8_t i = 0; i < OUTBOUND_REPLY_SLOTS; ++i) {
+                expect_numbered(queue, OUTBOUND_REPLY, i);
+        }
+        for (uint8_t i = 0; i <= OUTBOUND_TELEMETRY_SLOTS; ++i) {
+                expect_numbered(queue, OUTBOUND_TELEMETRY, i);
+        }
+        assert(queue.depth() == 0);
+}
+
+
+/* Telemetry can't evict anything - it spills like before */
+static void test_bulk_does_not_evict()
+{
+        OutboundQueue queue;
+
+        for (uint8_t i = 0; i < OUTBOUND_REPLY_SLOTS; ++i) {
+                push_numbered(queue, OUTBOUND_REPLY, i);
+        }
+        for (uint8_t i = 0; i < OUTBOUND_TELEMETRY_SLOTS + 1; ++i) {
+                push_numbered(queue, OUTBOUND_TELEMETRY, i);
+        }
+        assert(queue.stats().evicted == 0);
+        assert(queue.stats().spilled == 1);
+        assert(queue.depth(OUTBOUND_REPLY) == OUTBOUND_REPLY_SLOTS);
+
+        for (uint8_t i = 0; i < OUTBOUND_REPLY_SLOTS; ++i) {
+                expect_numbered(queue, OUTBOUND_REPLY, i);
+        }
+        for (uint8_t i = 0; i < OUTBOUND_TELEMETRY_SLOTS + 1; ++i) {
+                expect_numbered(queue, OUTBOUND_TELEMETRY, i);
+        }
+        assert(queue.depth() == 0);
+}
+
+
+/*
+ * Spilled telemetry waits while its class is at quota, and pop() and
+ * expire() don't open the file again until a record can come in.
+ */
+static void test_unspill_only_with_room()
+{
+        OutboundQueue queue;
+
+        for (uint8_t i = 0; i < OUTBOUND_TELEMETRY_SLOTS + 2; ++i) {
+                push_numbered(queue, OUTBOUND_TELEMETRY, i);
+        }
+        assert(queue.stats().spilled == 2);
+
+        // Full class - the first look finds that out, then we stop looking.
+        queue.expire();
+        uint32_t opens = SPIFFS.opens;
+        for (uint8_t i = 0; i < 10; ++i) {
+                queue.expire();
+        }
+        push_numbered(queue, OUTBOUND_REPLY, 0);
+        expect_numbered(queue, OUTBOUND_REPLY, 0);
+        assert(SPIFFS.opens == opens);
+
+        // Room in the class - one pop pulls one record in.
+        expect_numbered(queue, OUTBOUND_TELEMETRY, 0);
+        assert(SPIFFS.opens == opens + 1);
+        queue.expire();
+        assert(SPIFFS.opens == opens + 1);
+
+        for (uint8_t i = 1; i < OUTBOUND_TELEMETRY_SLOTS + 2; ++i) {
+                expect_numbered(queue, OUTBOUND_TELEMETRY, i);
+        }
+        assert(queue.depth() == 0);
+        assert(!SPIFFS.exists(OUTBOUND_SPILL_FILE));
+}
+
+
+/* A payload only fits if the whole PUBLISH packet does */
+static void test_packet_size()
+{
+        OutboundQueue queue;
+        const char* topic = "weather/telemetry";
+        char payload[maxMQTTpackageSize];
+
+        size_t room = mqtt_payload_room(topic);
+        assert(room == maxMQTTpackageSize - MQTT_PUBLISH_HEADER_LEN -
+                       strlen(topic) - 1);
+
+        memset(payload, 'x', room + 1);
+        payload[room + 1] = '\0';
+        assert(!queue.push(OUTBOUND_TELEMETRY, topic, payload));
+        assert(queue.stats().dropped_oversize == 1);
+
+        payload[room] = '\0';
+        assert(queue.push(OUTBOUND_TELEMETRY, topic, payload));
+        OutboundMessage* msg = queue.due(OUTBOUND_TELEMETRY);
+        assert(msg != NULL and strlen(msg->payload) == room);
+        queue.pop(OUTBOUND_TELEMETRY);
+}
+
+
+int main()
+{
+        SPIFFS.format();
+        assert(SPIFFS.begin());
+
+        test_alarm_behind_bulk();
+        test_bulk_does_not_evict();
+        test_unspill_only_with_room();
+        test_packet_size();
+
+        printf("test_outbound_queue: ok\n");
+        return 0;
+}
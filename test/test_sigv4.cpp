@@ -0,0 +1,193 @@
+/*
+ * SigV4 presigning: AWS's published examples for the signing key and the
+ * signature, the per-day key cache across midnight, and what the cache
+ * saves per connect.
+ *
+ * The presigned paths were worked out independently (Python's hashlib and
+ * hmac, following the SigV4 documentation) for the same inputs.
+ */
+#include <assert.h>
+#include <chrono>
+
+#include "../SigV4Presigner.hpp"
+
+
+static const char example_key[]         = "AKIDEXAMPLE";
+static const char example_secret[]      =
+        "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY";
+static const char example_region[]      = "us-east-1";
+static const char example_host[]        =
+        "example-ats.iot.us-east-1.amazonaws.com";
+
+// 2020-08-30 12:36:00, 23:59:59 and 2020-08-31 00:00:01 UTC
+static const time_t noon                = 1598790960;
+static const time_t before_midnight     = 1598831999;
+static const time_t after_midnight      = 1598832001;
+
+
+static void to_hex(const uint8_t* data, const size_t& len, char* out)
+{
+        for (size_t i = 0; i < len; ++i) {
+                sprintf(out + 2*i, "%02x", data[i]);
+        }
+}
+
+
+/* 'Deriving the signing key' example from the SigV4 documentation */
+static void test_signing_key_vector()
+{
+        uint8_t key[32];
+        char hex[65];
+        SigV4Presigner::derive_signing_key(
+                example_secret,
+                "20120215",
+                "us-east-1",
+                "iam",
+                key
+        );
+        to_hex(key, sizeof(key), hex);
+        assert(strcmp(hex, "f4780e2d9f65fa895f9c67b32ce1baf0"
+                           "b0d8a43505a000a1a9e090d414db404d") == 0);
+}
+
+
+/* 'get-vanilla' from the AWS SigV4 test suite */
+static void test_get_vanilla_vector()
+{
+        const char canonical_request[] =
+                "GET\n/\n\n"
+                "host:example.amazonaws.com\n"
+                "x-amz-date:20150830T123600Z\n\n"
+                "host;x-amz-date\n"
+                "e3b0c44298fc1c149afbf4c8996fb924"
+                "27ae41e4649b934ca495991b7852b855";
+        br_sha256_context sha;
+        uint8_t digest[32];
+        char request_hash[65];
+        br_sha256_init(&sha);
+        br_sha256_update(&sha, canonical_request, strlen(canonical_request));
+        br_sha256_out(&sha, digest);
+        to_hex(digest, sizeof(digest), request_hash);
+        assert(strcmp(request_hash, "bb579772317eb040ac9ed261061d46c1"
+                                    "f17a8133879d6129b6e1c25292927e63") == 0);
+
+        uint8_t key[32];
+        char signature[65];
+        SigV4Presigner::derive_signing_key(
+                example_secret,
+                "20150830",
+                "us-east-1",
+                "service",
+                key
+        );
+        assert(SigV4Presigner::sign(
+                key,
+                "20150830T123600Z",
+                "us-east-1",
+                "service",
+                request_hash,
+                signature
+        ));
+        assert(strcmp(signature, "5fa00fa31553b73ebf1942676e86291e"
+                                 "8372ff2a2260956d9b8aae1d763fbf31") == 0);
+}
+
+
+static const char* signature_of(const char* path)
+{
+        const char* signature = strstr(path, "&X-Amz-Signature=");
+        assert(signature != NULL);
+        return signature + 17;
+}
+
+
+static void test_presigned_path()
+{
+        SigV4Presigner presigner(example_region, example_key, example_secret);
+        const char* path = presigner.presign(example_host, 443, noon);
+        assert(path != NULL);
+        assert(strcmp(path,
+                "/mqtt?X-Amz-Algorithm=AWS4-HMAC-SHA256"
+                "&X-Amz-Credential=AKIDEXAMPLE%2F20200830%2Fus-east-1"
+                "%2Fiotdevicegateway%2Faws4_request"
+                "&X-Amz-Date=20200830T123600Z"
+                "&X-Amz-SignedHeaders=host"
+                "&X-Amz-Signature=a1b3a3d6e44d0681aa63d4a9f857875d"
+                "ac9003fac6d17451603327a87e3a93f9") == 0);
+
+        // No clock, no path - and the old one is gone.
+        assert(presigner.presign(example_host, 443, 0) == NULL);
+        assert(path[0] == '\0');
+}
+
+
+/* The cached key serves the whole day and is replaced at midnight */
+static void test_date_rollover()
+{
+        SigV4Presigner presigner(example_region, example_key, example_secret);
+
+        assert(presigner.presign(example_host, 443, noon) != NULL);
+        const char* path = presigner.presign(
+                example_host,
+                443,
+                before_midnight
+        );
+        assert(presigner.stats().key_derivations == 1);
+        assert(strstr(path, "%2F20200830%2F") != NULL);
+        assert(strcmp(signature_of(path), "3ba5be541aa57b2bb7fab411c18160b9"
+                                          "b45eaf54c2e22c304f0dc072b16e231a")
+               == 0);
+
+        path = presigner.presign(example_host, 443, after_midnight);
+        assert(presigner.stats().key_derivations == 2);
+        assert(strstr(path, "%2F20200831%2F") != NULL);
+        assert(strcmp(signature_of(path), "65db3ba5a7730b66c65193e5d5f506b1"
+                                          "63fcabbc24c981d46e46ec7e9c9f4593")
+               == 0);
+        assert(presigner.stats().signs == 3);
+}
+
+
+/* Connect-time signing with the cached key against deriving it each time */
+static void test_cache_timing()
+{
+        const uint16_t rounds = 2000;
+        typedef std::chrono::steady_clock clock;
+
+        SigV4Presigner cached(example_region, example_key, example_secret);
+        clock::time_point start = clock::now();
+        for (uint16_t i = 0; i < rounds; ++i) {
+                assert(cached.presign(example_host, 443, noon + i) != NULL);
+        }
+        double cached_us = std::chrono::duration<double, std::micro>(
+                clock::now() - start).count() / rounds;
+        assert(cached.stats().key_derivations == 1);
+
+        start = clock::now();
+        for (uint16_t i = 0; i < rounds; ++i) {
+                SigV4Presigner uncached(
+                        example_region,
+                        example_key,
+                        example_secret
+                );
+                assert(uncached.presign(example_host, 443, noon + i) != NULL);
+        }
+        double uncached_us = std::chrono::duration<double, std::micro>(
+                clock::now() - start).count() / rounds;
+
+        printf("test_sigv4: presign %.1f us with the cached key, "
+               "%.1f us deriving it (host)\n", cached_us, uncached_us);
+}
+
+
+int main()
+{
+        test_signing_key_vector();
+        test_get_vanilla_vector();
+        test_presigned_path();
+        test_date_rollover();
+        test_cache_timing();
+
+        printf("test_sigv4: ok\n");
+        return 0;
+}
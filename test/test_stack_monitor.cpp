@@ -0,0 +1,303 @@
+/*
+ * The stack budget: handlers run under STACK_SCOPE against a budget set
+ * for this test (STACK_HANDLER_BUDGET in the Makefile), and one that goes
+ * over it has to be caught - the warning logged, then the host assert.
+ *
+ * The sketch's handlers need ArduinoJson, Paho and the sensor libraries,
+ * which the host build doesn't have.  The handlers here do the same work
+ * on the same messages: parse the object in place, one recursive call per
+ * nesting level as ArduinoJson 5's parser does, then pick out the members.
+ */
+#include <assert.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../StackMonitor.hpp"
+#include "../Log.hpp"
+
+
+static char twilio_message[] =
+        "{\"To\":\"+18005551212\",\"From\":\"+14155550100\","
+        "\"Body\":\"weather?\",\"Type\":\"Incoming\"}";
+static char delta_message[] =
+        "{\"version\":412,\"timestamp\":1598790960,\"state\":"
+        "{\"alarm\":1598800000,\"units\":\"metric\",\"alt\":60,"
+        "\"tz\":-480,\"t_num\":\"+18005551212\","
+        "\"m_num\":\"+14155550100\"},\"metadata\":{\"state\":"
+        "{\"alarm\":{\"timestamp\":1598790960}}}}";
+
+// Members we pick out of a message, as pointers into it
+#define MAX_MEMBERS                     16
+
+
+struct Member {
+        const char*     key;
+        const char*     value;
+};
+
+
+/* Step over a string in place, terminating it - returns its start */
+static char* parse_string(char*& json)
+{
+        char* start = ++json;
+        while (*json != '"' and *json != '\0') {
+                json++;
+        }
+        if (*json == '"') {
+                *json++ = '\0';
+        }
+        return start;
+}
+
+
+/* One level of an object; nested objects recurse */
+static bool parse_object(char*& json, Member* members, uint8_t& count)
+{
+        if (*json++ != '{') {
+                return false;
+        }
+        while (*json != '}') {
+                if (*json == ',') {
+                        json++;
+                }
+                if (*json != '"') {
+                        return false;
+                }
+                char* key = parse_string(json);
+                if (*json++ != ':') {
+                        return false;
+                }
+
+                const char* value = json;
+                if (*json == '{') {
+                        if (!parse_object(json, members, count)) {
+                                return false;
+                        }
+                } else if (*json == '"') {
+                        value = parse_string(json);
+                } else {
+                        while (*json != ',' and *json != '}') {
+                                json++;
+                        }
+                }
+                if (count < MAX_MEMBERS) {
+                        members[count].key = key;
+                        members[count].value = value;
+                        count++;
+                }
+        }
+        json++;
+        return true;
+}
+
+
+static const char* member(
+        const Member* members,
+        const uint8_t& count,
+        const char* key
+)
+{
+        for (uint8_t i = 0; i < count; ++i) {
+                if (strcmp(members[i].key, key) == 0) {
+                        return members[i].value;
+                }
+        }
+        return NULL;
+}
+
+
+/* Append "key":value, as JsonObject::printTo() would - no printf */
+static void print_member(
+        char* out,
+        size_t& used,
+        const char* key,
+        const char* text,
+        const int32_t& number
+)
+{
+        char digits[12];
+        uint8_t len = 0;
+        uint32_t magnitude = number < 0 ? -(int64_t)number : number;
+        do {
+                digits[len++] = '0' + magnitude % 10;
+                magnitude /= 10;
+        } while (magnitude > 0);
+
+        out[used] = used == 0 ? '{' : ',';
+        used++;
+        out[used++] = '"';
+        while (*key != '\0') {
+                out[used++] = *key++;
+        }
+        out[used++] = '"';
+        out[used++] = ':';
+        if (text != NULL) {
+                out[used++] = '"';
+                while (*text != '\0') {
+                        out[used++] = *text++;
+                }
+                out[used++] = '"';
+        } else {
+                if (number < 0) {
+                        out[used++] = '-';
+                }
+                while (len > 0) {
+                        out[used++] = digits[--len];
+                }
+        }
+        out[used] = '\0';
+}
+
+
+/* report_shadow_state(): the reported state, printed into a packet */
+static void report_shadow_state()
+{
+        STACK_SCOPE(STACK_REPORT_SHADOW);
+
+        char payload[256];
+        size_t used = 0;
+        print_member(payload, used, "alarm", NULL, 1598800000);
+        print_member(payload, used, "units", "metric", 0);
+        print_member(payload, used, "alt", NULL, 60);
+        print_member(payload, used, "tz", NULL, -480);
+        print_member(payload, used, "t_num", "+18005551212", 0);
+        print_member(payload, used, "m_num", "+14155550100", 0);
+        payload[used++] = '}';
+        payload[used] = '\0';
+        assert(strstr(payload, ",\"tz\":-480,") != NULL);
+}
+
+
+/* process_twilio_message(): parse, check the numbers, fill in a report */
+static void process_twilio_message(char* msg)
+{
+        STACK_SCOPE(STACK_TWILIO_HANDLER);
+
+        Member members[MAX_MEMBERS];
+        uint8_t count = 0;
+        assert(parse_object(msg, members, count));
+        assert(strcmp(member(members, count, "To"), "+18005551212") == 0);
+        assert(strcmp(member(members, count, "Type"), "Incoming") == 0);
+
+        char weather_report[161];
+        strncpy(
+                weather_report,
+                member(members, count, "From"),
+                sizeof(weather_report)
+        );
+}
+
+
+/* process_shadow_delta(): parse, apply, report back - scopes nest */
+static void process_shadow_delta(char* msg)
+{
+        STACK_SCOPE(STACK_DELTA_HANDLER);
+
+        Member members[MAX_MEMBERS];
+        uint8_t count = 0;
+        assert(parse_object(msg, members, count));
+        assert(strcmp(member(members, count, "units"), "metric") == 0);
+        assert(atoi(member(members, count, "tz")) == -480);
+
+        report_shadow_state();
+}
+
+
+/* A handler with a frame too big for the budget */
+static void __attribute__((noinline)) greedy_handler()
+{
+        STACK_SCOPE(STACK_TWILIO_HANDLER);
+
+        volatile uint8_t buffer[STACK_HANDLER_BUDGET + 256];
+        for (size_t i = 0; i < sizeof(buffer); ++i) {
+                buffer[i] = i;
+        }
+}
+
+
+/* Log lines, to a pipe the parent reads */
+class PipePrint : public Print {
+public:
+        PipePrint(const int& fd_in) : fd(fd_in) {}
+
+        size_t write(uint8_t c) { return write(&c, 1); }
+        size_t write(const uint8_t* buffer, size_t size)
+        {
+                return ::write(fd, buffer, size);
+        }
+
+private:
+        int fd;
+};
+
+
+static void test_handlers_within_budget()
+{
+        process_twilio_message(twilio_message);
+        process_shadow_delta(delta_message);
+
+        const StackStats& stats = stack_stats();
+        assert(stats.over_budget == 0);
+        assert(stats.high_water[STACK_TWILIO_HANDLER] > 0);
+        assert(stats.high_water[STACK_REPORT_SHADOW] > 0);
+
+        // The delta handler's scope saw everything report_shadow_state did.
+        assert(stats.high_water[STACK_DELTA_HANDLER] >=
+               stats.high_water[STACK_REPORT_SHADOW]);
+        assert(stats.deepest <= STACK_HANDLER_BUDGET);
+
+        printf(
+                "test_stack_monitor: twilio %u, delta %u, report %u bytes "
+                "of a %u budget (host)\n",
+                stats.high_water[STACK_TWILIO_HANDLER],
+                stats.high_water[STACK_DELTA_HANDLER],
+                stats.high_water[STACK_REPORT_SHADOW],
+                STACK_HANDLER_BUDGET
+        );
+}
+
+
+/* The child logs the overrun and dies on the assert */
+static void test_over_budget_caught()
+{
+        int fds[2];
+        assert(pipe(fds) == 0);
+
+        pid_t child = fork();
+        assert(child >= 0);
+        if (child == 0) {
+                close(fds[0]);
+                freopen("/dev/null", "w", stderr);
+                PipePrint log_pipe(fds[1]);
+                log_set_output(&log_pipe);
+                greedy_handler();
+                _exit(0);
+        }
+
+        close(fds[1]);
+        char log[LOG_LINE_LEN + 1];
+        ssize_t len = read(fds[0], log, sizeof(log) - 1);
+        close(fds[0]);
+
+        int status;
+        assert(waitpid(child, &status, 0) == child);
+        assert(WIFSIGNALED(status) and WTERMSIG(status) == SIGABRT);
+
+        assert(len > 0);
+        log[len] = '\0';
+        assert(strstr(log, "twilio_handler used") != NULL);
+        assert(strstr(log, "budget") != NULL);
+}
+
+
+int main()
+{
+        stack_begin();
+
+        test_handlers_within_budget();
+        test_over_budget_caught();
+
+        printf("test_stack_monitor: ok\n");
+        return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * The constexpr topic_route() has to agree with TopicTrie::match() - the
+ * sketch's static_asserts on its route table are only as good as that.
+ */
+#include <assert.h>
+
+#include "../TopicTrie.hpp"
+
+
+static void on_twilio(MQTT::MessageData& md) { (void)md; }
+static void on_delta(MQTT::MessageData& md) { (void)md; }
+static void on_shadow(MQTT::MessageData& md) { (void)md; }
+static void on_any(MQTT::MessageData& md) { (void)md; }
+static void on_logs(MQTT::MessageData& md) { (void)md; }
+
+
+// twilio, twilio/delta, twilio/+/any, $aws/things/+/shadow/update, logs/#
+constexpr TopicNode routes[] = {
+        /* 0 */ { "twilio",  1, 4, on_twilio },
+        /* 1 */ { "delta",  -1, 2, on_delta },
+        /* 2 */ { "+",       3,-1, NULL },
+        /* 3 */ { "any",    -1,-1, on_any },
+        /* 4 */ { "$aws",    5, 9, NULL },
+        /* 5 */ { "things",  6,-1, NULL },
+        /* 6 */ { "+",       7,-1, NULL },
+        /* 7 */ { "shadow",  8,-1, NULL },
+        /* 8 */ { "update", -1,-1, on_shadow },
+        /* 9 */ { "logs",   10,-1, NULL },
+        /* 10 */ { "#",     -1,-1, on_logs },
+};
+
+static_assert(topic_route(routes, "twilio") == on_twilio, "exact");
+static_assert(topic_route(routes, "twilio/delta") == on_delta, "exact");
+static_assert(topic_route(routes, "twilio/x/any") == on_any, "+");
+static_assert(
+        topic_route(routes, "$aws/things/my thing/shadow/update") ==
+                on_shadow,
+        "+ in the middle"
+);
+static_assert(topic_route(routes, "logs/a/b") == on_logs, "#");
+static_assert(topic_route(routes, "logs") == on_logs, "# takes its parent");
+static_assert(topic_route(routes, "twilio/x") == NULL, "+ doesn't");
+static_assert(topic_route(routes, "twilio/nope") == NULL, "no route");
+
+
+static const char* const topics[] = {
+        "twilio",
+        "twilio/delta",
+        "twilio/delta/more",
+        "twilio/x/any",
+        "twilio/x",
+        "twilio/",
+        "twilio/delta/",
+        "$aws/things/t/shadow/update",
+        "$aws/things/t/shadow",
+        "$aws/things/t/shadow/update/x",
+        "logs",
+        "logs/",
+        "logs/a/b",
+        "weather/telemetry",
+        "",
+};
+
+
+int main()
+{
+        TopicTrie trie(routes);
+        for (size_t i = 0; i < sizeof(topics) / sizeof(topics[0]); ++i) {
+                const char* topic = topics[i];
+                assert(trie.match(topic, strlen(topic)) ==
+                       topic_route(routes, topic));
+        }
+        assert(trie.match("logs", 4) == on_logs);
+
+        printf("test_topic_trie: ok\n");
+        return 0;
+}
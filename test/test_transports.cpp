@@ -0,0 +1,184 @@
+/*
+ * Both transports against the loopback broker: what each puts on the link
+ * per MQTT packet, and how long each takes from connect() to CONNACK.
+ *
+ * The link is a fixed number of milliseconds per round trip, so connect
+ * times here count round trips - the TLS handshake's CPU time on the board
+ * comes on top, and shows in the "hs" histogram of the metrics.
+ */
+#include <assert.h>
+
+#include "../WebSocketTransport.hpp"
+#include "../MqttTlsTransport.hpp"
+
+
+static const char endpoint[]            =
+        "example-ats.iot.us-east-1.amazonaws.com";
+static const char topic[]               = "weather/metrics";
+
+// Round trip on the simulated link
+static const uint32_t rtt               = 100;
+
+
+/* CONNECT with a client ID, clean session, 60 s keepalive */
+static size_t mqtt_connect(uint8_t* packet)
+{
+        static const char client_id[] = "weather-station";
+        static const uint8_t variable[] = {
+                0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3c
+        };
+        size_t id_len = sizeof(client_id) - 1;
+
+        packet[0] = 0x10;
+        packet[1] = sizeof(variable) + 2 + id_len;
+        memcpy(packet + 2, variable, sizeof(variable));
+        packet[12] = 0;
+        packet[13] = id_len;
+        memcpy(packet + 14, client_id, id_len);
+        return 14 + id_len;
+}
+
+
+/* PUBLISH at QoS 0 with a payload of 'x's */
+static size_t mqtt_publish(uint8_t* packet, const size_t& payload_len)
+{
+        size_t topic_len = sizeof(topic) - 1;
+        size_t remaining = 2 + topic_len + payload_len;
+        size_t used = 0;
+
+        packet[used++] = 0x30;
+        do {
+                uint8_t digit = remaining % 128;
+                remaining /= 128;
+                packet[used++] = digit | (remaining > 0 ? 0x80 : 0);
+        } while (remaining > 0);
+        packet[used++] = 0;
+        packet[used++] = topic_len;
+        memcpy(packet + used, topic, topic_len);
+        used += topic_len;
+        memset(packet + used, 'x', payload_len);
+        return used + payload_len;
+}
+
+
+/* Connect and wait for the CONNACK.  Returns the milliseconds it took. */
+static uint32_t connect_mqtt(MqttTransport& transport)
+{
+        uint8_t packet[64];
+        uint32_t start = millis();
+
+        assert(transport.connect(transport.host(), transport.port()) == 1);
+        size_t len = mqtt_connect(packet);
+        assert(transport.write(packet, len) == len);
+        while (transport.available() < 4) {
+                assert(millis() - start < 10 * rtt);
+                delay(1);
+        }
+        assert(transport.read(packet, 4) == 4);
+        assert(packet[0] == 0x20 and packet[3] == 0x00);
+        return millis() - start;
+}
+
+
+/* Bytes on the link for one PUBLISH, checking the broker got it whole */
+static uint32_t publish_bytes(
+        MqttTransport& transport,
+        const size_t& payload_len,
+        size_t* mqtt_len
+)
+{
+        uint8_t packet[LOOPBACK_MAX_PACKET];
+        const LoopbackStats& link = loopback_broker.stats();
+        uint32_t publishes = link.publishes;
+        uint32_t up = link.bytes_up;
+        uint32_t bytes_out = transport.stats().bytes_out;
+
+        *mqtt_len = mqtt_publish(packet, payload_len);
+        assert(transport.write(packet, *mqtt_len) == *mqtt_len);
+
+        assert(transport.stats().bytes_out - bytes_out == *mqtt_len);
+        assert(link.publishes == publishes + 1);
+        assert(strcmp(loopback_broker.last_topic, topic) == 0);
+        assert(loopback_broker.last_payload_len == payload_len);
+        for (size_t i = 0; i < payload_len; ++i) {
+                assert(loopback_broker.last_payload[i] == 'x');
+        }
+        return link.bytes_up - up;
+}
+
+
+int main()
+{
+        loopback_broker.rtt = rtt;
+
+        MqttTlsTransport mqtts(endpoint, "ca", "cert", "key");
+        WebSocketTransport wss(
+                "us-east-1",
+                "AKIDEXAMPLE",
+                "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY",
+                endpoint
+        );
+
+        // TCP, two round trips of TLS, CONNECT - and one fewer to resume
+        uint32_t full_ms = connect_mqtt(mqtts);
+        uint32_t resumed_ms = connect_mqtt(mqtts);
+        assert(full_ms == 4 * rtt);
+        assert(resumed_ms == 3 * rtt);
+        assert(mqtts.handshake_stats().full_count == 1);
+        assert(mqtts.handshake_stats().resumed_count == 1);
+
+        static const size_t payloads[] = { 16, 120, 400 };
+        uint32_t mqtts_bytes[3];
+        size_t mqtt_len[3];
+        for (uint8_t i = 0; i < 3; ++i) {
+                mqtts_bytes[i] = publish_bytes(mqtts, payloads[i],
+                                               &mqtt_len[i]);
+                assert(mqtts_bytes[i] ==
+                       mqtt_len[i] + LOOPBACK_TLS_RECORD_OVERHEAD);
+        }
+        mqtts.stop();
+
+        // The upgrade is one more round trip, and there's no resuming
+        uint32_t wss_ms = connect_mqtt(wss);
+        uint32_t wss_again_ms = connect_mqtt(wss);
+        assert(wss_ms == full_ms + rtt);
+        assert(wss_again_ms == wss_ms);
+        assert(wss.handshake_stats().full_count == 2);
+        assert(wss.handshake_stats().resumed_count == 0);
+
+        // Frame header and mask in their own record, then the payload
+        uint32_t wss_bytes[3];
+        for (uint8_t i = 0; i < 3; ++i) {
+                size_t len;
+                wss_bytes[i] = publish_bytes(wss, payloads[i], &len);
+                assert(len == mqtt_len[i]);
+                size_t header = len < 126 ? 6 : 8;
+                assert(wss_bytes[i] ==
+                       len + header + 2 * LOOPBACK_TLS_RECORD_OVERHEAD);
+        }
+        wss.stop();
+
+        printf(
+                "test_transports: %u ms round trips - connect to CONNACK "
+                "mqtts %u ms (%u resumed), wss %u ms\n",
+                rtt,
+                full_ms,
+                resumed_ms,
+                wss_ms
+        );
+        for (uint8_t i = 0; i < 3; ++i) {
+                printf(
+                        "test_transports: %3u B payload, %3u B MQTT - "
+                        "mqtts %3u B on the link (+%u), "
+                        "wss %3u B (+%u)\n",
+                        (unsigned)payloads[i],
+                        (unsigned)mqtt_len[i],
+                        mqtts_bytes[i],
+                        (unsigned)(mqtts_bytes[i] - mqtt_len[i]),
+                        wss_bytes[i],
+                        (unsigned)(wss_bytes[i] - mqtt_len[i])
+                );
+        }
+        printf("test_transports: ok\n");
+        return 0;
+}